@@ -0,0 +1,114 @@
+#include "Lexer.h"
+#include "SwitchLexer.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/Timer.h"
+#include "llvm/Support/raw_ostream.h"
+
+// Token count and a checksum of the kinds and lengths, so both lexers can
+// be checked to produce the same stream.
+struct Stream
+{
+    uint64_t NumTokens = 0;
+    uint64_t Checksum = 0;
+
+    void add(unsigned Kind, size_t Length)
+    {
+        ++NumTokens;
+        Checksum = Checksum * 31 + Kind * 1021 + Length;
+    }
+
+    bool operator==(const Stream &Other) const
+    {
+        return NumTokens == Other.NumTokens && Checksum == Other.Checksum;
+    }
+};
+
+template <typename LexerT>
+Stream lex(llvm::StringRef Buffer)
+{
+    LexerT Lex(Buffer);
+    typename LexerT::Token Tok;
+    Stream S;
+    for (Lex.next(Tok); Tok.Kind != Token::eoi; Lex.next(Tok))
+        S.add(Tok.Kind, Tok.Text.size());
+    return S;
+}
+
+// Adapts the table lexer to the interface lex() expects.
+struct TableLexer
+{
+    struct Token
+    {
+        ::Token::TokenKind Kind;
+        llvm::StringRef Text;
+    };
+
+    Lexer Lex;
+
+    TableLexer(llvm::StringRef Buffer) : Lex(Buffer) {}
+
+    void next(Token &Result)
+    {
+        ::Token Tok;
+        Lex.next(Tok);
+        Result.Kind = Tok.getKind();
+        Result.Text = Tok.getText();
+    }
+};
+
+// Returns the best wall time of Repeat runs of LexerT over Buffer.
+template <typename LexerT>
+double timeLexer(llvm::StringRef Buffer, unsigned Repeat, Stream &Result)
+{
+    double Best = 0;
+    for (unsigned I = 0; I < Repeat; ++I)
+    {
+        llvm::TimeRecord Start = llvm::TimeRecord::getCurrentTime(true);
+        Result = lex<LexerT>(Buffer);
+        double Seconds = llvm::TimeRecord::getCurrentTime(false).getWallTime() - Start.getWallTime();
+        if (I == 0 || Seconds < Best)
+            Best = Seconds;
+    }
+    return Best;
+}
+
+static void report(const char *Name, const Stream &S, size_t Bytes, double Seconds)
+{
+    llvm::outs() << Name << ": " << S.NumTokens << " tokens (" << Bytes << " bytes) in "
+                 << llvm::format("%.6f", Seconds) << " s, "
+                 << llvm::format("%.3f", Seconds > 0 ? Bytes / Seconds / 1e9 : 0.0) << " GB/s\n";
+}
+
+// Times the switch lexer and the table lexer on the same file:
+// lexer_bench <file> [repeat]
+int main(int argc, const char **argv)
+{
+    if (argc < 2)
+    {
+        llvm::errs() << "usage: " << argv[0] << " <file> [repeat]\n";
+        return 1;
+    }
+    unsigned Repeat = argc > 2 ? std::max(1, atoi(argv[2])) : 5;
+
+    llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> BufferOrErr = llvm::MemoryBuffer::getFile(argv[1]);
+    if (std::error_code EC = BufferOrErr.getError())
+    {
+        llvm::errs() << "Error: Unable to open " << argv[1] << " file: " << EC.message() << "\n";
+        return 1;
+    }
+    llvm::StringRef Buffer = (*BufferOrErr)->getBuffer();
+
+    Stream Switch, Table;
+    double SwitchSeconds = timeLexer<SwitchLexer>(Buffer, Repeat, Switch);
+    double TableSeconds = timeLexer<TableLexer>(Buffer, Repeat, Table);
+    report("switch lexer", Switch, Buffer.size(), SwitchSeconds);
+    report("table lexer", Table, Buffer.size(), TableSeconds);
+
+    // the switch lexer reads a lone '!' as '+'; anything else must match
+    if (!(Switch == Table))
+    {
+        llvm::errs() << "Error: the lexers produced different token streams\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,27 @@
+#ifndef SWITCHLEXER_H
+#define SWITCHLEXER_H
+
+#include "Lexer.h"
+
+// The lexer as it was before the tables: keywords are found by comparing
+// strings one at a time and operators by a nested switch. It is kept only
+// so lexer_bench can time both on the same input.
+class SwitchLexer
+{
+    const char *BufferPtr; // pointer to the next unprocessed character
+
+public:
+    struct Token
+    {
+        ::Token::TokenKind Kind;
+        llvm::StringRef Text;
+    };
+
+    SwitchLexer(const llvm::StringRef &Buffer) : BufferPtr(Buffer.begin()) {}
+
+    void next(Token &token); // return the next token
+
+private:
+    void formToken(Token &Result, const char *TokEnd, ::Token::TokenKind Kind);
+};
+#endif
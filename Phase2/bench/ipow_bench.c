@@ -0,0 +1,44 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+int ark_ipow(int base, int exp);
+
+/* The loop x ^ n compiled to before ark_ipow: n - 1 multiplies. */
+__attribute__((noinline)) static int naive_ipow(int base, int exp)
+{
+    unsigned result = 1;
+    for (int i = 0; i < exp; ++i)
+        result *= (unsigned)base;
+    return (int)result;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Times <calls> calls of ark_ipow and of the naive loop with exponent <exp>:
+   ipow_bench [calls] [exp] */
+int main(int argc, char **argv)
+{
+    long calls = argc > 1 ? atol(argv[1]) : 10000000;
+    int exp = argc > 2 ? atoi(argv[2]) : 1000;
+    volatile int sink = 0;
+
+    double start = now();
+    for (long i = 0; i < calls; ++i)
+        sink += ark_ipow((int)i, exp);
+    double ipow = now() - start;
+
+    start = now();
+    for (long i = 0; i < calls; ++i)
+        sink += naive_ipow((int)i, exp);
+    double naive = now() - start;
+
+    printf("ark_ipow: %ld calls in %f s\n", calls, ipow);
+    printf("naive loop: %ld calls in %f s\n", calls, naive);
+    return 0;
+}
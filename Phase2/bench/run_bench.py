@@ -0,0 +1,201 @@
+#!/usr/bin/env python3
+"""Benchmarks for the ARK compiler.
+
+Each benchmark writes its input program into the work directory, runs
+the compiler on it and prints what it measured, the best of --repeat
+runs. Configure the build with -DCMAKE_BUILD_TYPE=Release first, then
+run one benchmark, several, or all of them:
+
+    python3 run_bench.py --ark build/src/ARK lexer
+    cmake --build build --target bench
+
+Point --ark at a build of another commit to compare the two.
+"""
+
+import argparse
+import os
+import re
+import resource
+import subprocess
+import sys
+
+BENCHMARKS = {}
+
+
+def benchmark(func):
+    BENCHMARKS[func.__name__.replace('_', '-')] = func
+    return func
+
+
+def generate(args, name, text):
+    """Writes text to name in the work directory once and returns its path."""
+    path = os.path.join(args.work_dir, name)
+    if not os.path.exists(path):
+        os.makedirs(args.work_dir, exist_ok=True)
+        with open(path, 'w') as f:
+            f.write(text)
+    return path
+
+
+def raise_stack_limit():
+    """Lets the compiler recurse as deep as the trees the benchmarks build."""
+    soft, hard = resource.getrlimit(resource.RLIMIT_STACK)
+    resource.setrlimit(resource.RLIMIT_STACK, (hard, hard))
+
+
+def run(command):
+    """Runs command and returns what it printed to stderr."""
+    result = subprocess.run(command, stdout=subprocess.DEVNULL, stderr=subprocess.PIPE, text=True,
+                            preexec_fn=raise_stack_limit)
+    if result.returncode:
+        sys.exit('%s failed:\n%s' % (' '.join(command), result.stderr[-2000:]))
+    return result.stderr
+
+
+def best_of(args, command, *patterns):
+    """Runs command --repeat times and returns, for each pattern, the
+    smallest float it captures from the stderr of a run."""
+    best = [None] * len(patterns)
+    for _ in range(args.repeat):
+        output = run(command)
+        for i, pattern in enumerate(patterns):
+            match = re.search(pattern, output, re.M)
+            if not match:
+                sys.exit('no match for %r in the output of %s' % (pattern, ' '.join(command)))
+            value = float(match.group(1))
+            best[i] = value if best[i] is None else min(best[i], value)
+    return best
+
+
+@benchmark
+def lexer(args):
+    """Tokenizes a 60 MB keyword-heavy program with -lex-only, then with
+    the table lexer and the switch lexer it replaced side by side."""
+    block = ('int a, b, c, result;\n'
+             'if a >= 10 and b <= 20 or c == 3: begin\n'
+             '    result += a * (b - c) / 7;\n'
+             '    c %= 5;\n'
+             'end\n'
+             'elif a != b: begin\n'
+             '    b -= 1;\n'
+             'end\n'
+             'else: begin\n'
+             '    a = b ^ 2;\n'
+             'end\n'
+             'loopc a < 100: begin\n'
+             '    a += 1;\n'
+             'end\n')
+    path = generate(args, 'lexer.ARK', block * (60 * 1000 * 1000 // len(block)))
+    seconds, = best_of(args, [args.ark, path, '-lex-only'], r'in ([0-9.]+) s,')
+    size = os.path.getsize(path)
+    print('lexer: %d bytes in %.4f s, %.3f GB/s' % (size, seconds, size / seconds / 1e9))
+    if not args.lexer_bench:
+        print('lexer: comparison with the switch lexer skipped, pass --lexer-bench')
+        return
+    result = subprocess.run([args.lexer_bench, path, str(args.repeat)], stdout=subprocess.PIPE, text=True, check=True)
+    print('lexer: ' + result.stdout.rstrip().replace('\n', '\nlexer: '))
+
+
+def phase_time(name):
+    """Matches the wall time of the -time-phases line for phase name."""
+    return r'([0-9.]+) \(\s*[0-9.]+%\)\s+' + re.escape(name) + '$'
+
+
+@benchmark
+def flat_ast(args):
+    """Compiles a 10M-node program through the pointer tree and through the
+    flat form, which the parser builds instead of the tree, phase by phase.
+    x is only known at runtime, so nothing folds, and all but every 1000th
+    declaration is dead."""
+    count = 909000
+    lines = ['int x = 0;', 'loopc x < 3: begin', '  x += 1;', 'end', 'int result = 0;']
+    for i in range(count):
+        lines.append('int a%d = (x + %d) * (x - 5) / 7;' % (i, i))
+        if i % 1000 == 999:
+            lines.append('result += a%d;' % i)
+    path = generate(args, 'flat_ast_10m.ARK', '\n'.join(lines) + '\n')
+    phases = ['Lex and parse', 'Semantic analysis', 'Optimization', 'Code generation']
+    for form, flags, memory in (('tree', [], r'^AST: (\d+) bytes'),
+                                ('flat', ['-flat-ast'], r'^Flat AST: \d+ nodes in (\d+) bytes')):
+        command = [args.ark, path, '-debug-dump=false', '-time-phases'] + flags
+        results = best_of(args, command, memory, *[phase_time(phase) for phase in phases])
+        print('flat-ast: %s: %d bytes, ' % (form, results[0]) +
+              ', '.join('%s %.4f s' % (phase.lower(), seconds) for phase, seconds in zip(phases, results[1:])))
+
+
+def optimize_time(args, path):
+    """Returns the best time of the optimizer phase on path, with the
+    debug output, which would dominate it, turned off."""
+    seconds, = best_of(args, [args.ark, path, '-debug-dump=false', '-time-phases'],
+                       phase_time('Optimization'))
+    return seconds
+
+
+@benchmark
+def liveness(args):
+    """Solves liveness on long dependency chains and on a wide fan-in."""
+    def chain(count):
+        lines = ['int v0 = 1;']
+        lines += ['int v%d = v%d + %d;' % (i, i - 1, i % 4) for i in range(1, count)]
+        lines.append('int result = v%d;' % (count - 1))
+        return '\n'.join(lines) + '\n'
+
+    count = 150000
+    fan = ['int w%d = %d;' % (i, i) for i in range(count)]
+    fan.append('int result = 0;')
+    fan += ['result += w%d;' % i for i in range(count)]
+    inputs = [('150000-variable chain', generate(args, 'liveness_chain.ARK', chain(count))),
+              ('150000-variable fan-in', generate(args, 'liveness_fan.ARK', '\n'.join(fan) + '\n')),
+              ('1000000-variable chain', generate(args, 'liveness_long_chain.ARK', chain(1000000)))]
+    for name, path in inputs:
+        print('liveness: %s, optimizer %.4f s' % (name, optimize_time(args, path)))
+
+@benchmark
+def traversal(args):
+    """Walks deep and wide expression trees in the semantic check."""
+    deep = 'int a = 1;\nint result = ' + ' + '.join(['a'] * 1000000) + ';\n'
+    wide = ['int a = 1;', 'int result = 0;']
+    wide += ['result = ' + ' + '.join(['a'] * 5001) + ';'] * 200
+    inputs = [('1000000-deep + chain', generate(args, 'traversal_deep.ARK', deep)),
+              ('200 statements of 5000 operators', generate(args, 'traversal_wide.ARK', '\n'.join(wide) + '\n'))]
+    for name, path in inputs:
+        seconds, = best_of(args, [args.ark, path, '-time-phases'], phase_time('Semantic analysis'))
+        print('traversal: %s, semantic check %.4f s' % (name, seconds))
+
+@benchmark
+def compaction(args):
+    """Removes dead statements from a program where 90% of them are dead."""
+    count = 200000
+    lines = ['int result = 0;']
+    for i in range(count):
+        lines.append('int d%d = %d;' % (i, i % 50))
+        lines.append('result += d%d;' % i if i % 10 == 0 else 'd%d += 1;' % i)
+    path = generate(args, 'compaction.ARK', '\n'.join(lines) + '\n')
+    print('compaction: %d statements, optimizer %.4f s' % (len(lines), optimize_time(args, path)))
+
+@benchmark
+def ipow(args):
+    """Times 10M calls of ark_ipow and of a naive multiply loop at exponent 1000."""
+    if not args.ipow_bench:
+        print('ipow: skipped, pass --ipow-bench')
+        return
+    result = subprocess.run([args.ipow_bench], stdout=subprocess.PIPE, text=True, check=True)
+    print('ipow: ' + result.stdout.rstrip().replace('\n', '\nipow: '))
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--ark', required=True, help='the ARK compiler to measure')
+    parser.add_argument('--lexer-bench', help='the lexer_bench program, to compare with the switch lexer')
+    parser.add_argument('--ipow-bench', help='the ipow_bench program, for the ipow benchmark')
+    parser.add_argument('--work-dir', default='bench-inputs', help='where the generated programs are kept')
+    parser.add_argument('--repeat', type=int, default=5, help='runs per measurement')
+    parser.add_argument('benchmarks', nargs='+', choices=sorted(BENCHMARKS) + ['all'])
+    args = parser.parse_args()
+
+    names = sorted(BENCHMARKS) if 'all' in args.benchmarks else args.benchmarks
+    for name in names:
+        BENCHMARKS[name](args)
+
+
+if __name__ == '__main__':
+    main()
@@ -6,6 +6,20 @@ void ark_write(int v)
     printf("Assigment result is: %d\n", v);
 }
 
+/* base ^ exp by square-and-multiply: at most 31 rounds, and the multiply by
+   the current square is a select rather than a branch. A negative exponent
+   counts as zero; the product wraps around on overflow. */
+int ark_ipow(int base, int exp)
+{
+    unsigned result = 1, square = (unsigned)base;
+    for (; exp > 0; exp >>= 1)
+    {
+        result *= (exp & 1) ? square : 1u;
+        square *= square;
+    }
+    return (int)result;
+}
+
 int ark_read(char *s)
 {
     char buf[64];
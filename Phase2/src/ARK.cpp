@@ -1,71 +1,221 @@
 #include "CodeGen.h"
+#include "FlatAST.h"
 #include "Parser.h"
 #include "Sema.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
 #include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Timer.h"
 #include "llvm/Support/raw_ostream.h"
-#include <fstream>
 #include "Optimizer.h"
 
-// Define a command-line option for specifying the input expression.
+// Define a command-line option for specifying the input file ("-" reads stdin).
 static llvm::cl::opt<std::string>
-    Input(llvm::cl::Positional,
-          llvm::cl::desc("<input expression>"),
-          llvm::cl::init(""));
+    InputFilename(llvm::cl::Positional,
+                  llvm::cl::desc("<input file>"),
+                  llvm::cl::init("main.ARK"));
 
-// The main function of the program.
-int main(int argc, const char **argv)
-{
-    bool debugMode = true;
+// Define a command-line option for reporting the time spent in each phase.
+static llvm::cl::opt<bool>
+    TimePhases("time-phases",
+               llvm::cl::desc("Report the time spent loading, parsing, checking, optimizing and generating code"),
+               llvm::cl::init(false));
 
-    // Initialize the LLVM framework.
-    llvm::InitLLVM X(argc, argv);
+// Define a command-line option for benchmarking the lexer on its own.
+static llvm::cl::opt<bool>
+    LexOnly("lex-only",
+            llvm::cl::desc("Only tokenize the input and report the lexer throughput"),
+            llvm::cl::init(false));
 
-    std::ifstream inFile("main.ARK");
-    if (!inFile)
-    {
-        llvm::errs() << "Error: Unable to open main.ARK file\n";
-        return 1;
-    }
-    std::string Input((std::istreambuf_iterator<char>(inFile)), std::istreambuf_iterator<char>());
+// Define a command-line option for compiling through the flat form of the AST.
+static llvm::cl::opt<bool>
+    UseFlatAST("flat-ast",
+               llvm::cl::desc("Parse into the flat structure-of-arrays AST and check, optimize and generate code from it"),
+               llvm::cl::init(false));
+
+// Define a command-line option for naming the variables whose writes are printed.
+static llvm::cl::list<std::string>
+    OutputVars("output",
+               llvm::cl::desc("Print the writes to these variables and keep what they depend on (default: result)"),
+               llvm::cl::value_desc("var"),
+               llvm::cl::CommaSeparated);
 
-    // Create a lexer object and initialize it with the input expression.
-    Lexer Lex(Input);
+// Define a command-line option for printing every write instead.
+static llvm::cl::opt<bool>
+    OutputAll("output-all",
+              llvm::cl::desc("Print the writes to every variable"),
+              llvm::cl::init(false));
 
-    // Create a parser object and initialize it with the lexer.
-    Parser Parser(Lex);
+// Define a command-line option for turning off the debug output, e.g. to time the optimizer.
+static llvm::cl::opt<bool>
+    DebugMode("debug-dump",
+              llvm::cl::desc("Print the module before optimization and the optimizer's analysis"),
+              llvm::cl::init(true));
 
-    // Parse the input expression and generate an abstract syntax tree (AST).
-    AST *Tree = Parser.parse();
+// Resolves the observable variables once every name has been interned. A
+// name the program never declares is an error rather than an empty set,
+// which would let the optimizer delete the whole program.
+static bool resolveOutputs(ASTContext &Context, OutputSet &Outputs)
+{
+    if (OutputAll)
+        Outputs = OutputSet::allWrites(Context.getNumSymbols());
+    else if (OutputVars.empty())
+        Outputs.add(Context.intern("result"));
+    else
+        for (const std::string &Var : OutputVars)
+        {
+            llvm::Optional<unsigned> Symbol = Context.lookup(Var);
+            if (!Symbol)
+            {
+                llvm::errs() << "Error: output variable " << Var << " is not declared in the program\n";
+                return false;
+            }
+            Outputs.add(*Symbol);
+        }
+    return true;
+}
 
-    // Check if parsing was successful or if there were any syntax errors.
-    if (!Tree || Parser.hasError())
+// Checks, optimizes and generates code for the parsed program, either the
+// pointer tree or its flat form.
+template <typename ProgramT>
+static int compile(ProgramT &Program, ASTContext &Context, llvm::Timer &SemaTimer,
+                   llvm::Timer &OptTimer, llvm::Timer &CodeGenTimer)
+{
+    // Perform semantic analysis on the AST.
     {
-        llvm::errs() << "Syntax errors occurred\n";
-        return 1;
+        llvm::TimeRegion Region(TimePhases ? &SemaTimer : nullptr);
+        Sema Semantic;
+        if (Semantic.semantic(Program, Context)) {
+            llvm::errs() << "Semantic errors occurred\n";
+            return 1;
+        }
     }
 
-    // Perform semantic analysis on the AST.
-   Sema Semantic;
-   if (Semantic.semantic(Tree)) {
-       llvm::errs() << "Semantic errors occurred\n";
-       return 1;
-   }
+    OutputSet Outputs;
+    if (!resolveOutputs(Context, Outputs))
+        return 1;
 
-    if(debugMode) {
+    if(DebugMode) {
         llvm::errs() << "############ Code BEFORE Optimization: ############\n\n";
         //Generate code for the AST using a code generator.
         CodeGen CodeGenerator;
-        CodeGenerator.compile(Tree);
+        CodeGenerator.compile(Program, Context, Outputs);
         llvm::errs() << "\n############ Code AFTER Optimization: ############ \n";
     }
 
-    Optimizer Optimizer;
-    Optimizer.optimize(Tree, debugMode);
+    {
+        llvm::TimeRegion Region(TimePhases ? &OptTimer : nullptr);
+        Optimizer Optimizer;
+        Optimizer.optimize(Program, Context, Outputs, DebugMode);
+    }
 
     //Generate code for the AST using a code generator.
-    CodeGen CodeGenerator;
-    CodeGenerator.compile(Tree);
+    {
+        llvm::TimeRegion Region(TimePhases ? &CodeGenTimer : nullptr);
+        CodeGen CodeGenerator;
+        CodeGenerator.compile(Program, Context, Outputs);
+    }
+    return 0;
+}
+
+// The main function of the program.
+int main(int argc, const char **argv)
+{
+    // Initialize the LLVM framework.
+    llvm::InitLLVM X(argc, argv);
+    llvm::cl::ParseCommandLineOptions(argc, argv, "ARK compiler\n");
+
+    llvm::TimerGroup PhaseTimers("ark", "ARK compiler phases");
+    llvm::Timer LoadTimer("load", "Load input", PhaseTimers);
+    llvm::Timer ParseTimer("parse", "Lex and parse", PhaseTimers);
+    llvm::Timer SemaTimer("sema", "Semantic analysis", PhaseTimers);
+    llvm::Timer OptTimer("optimize", "Optimization", PhaseTimers);
+    llvm::Timer CodeGenTimer("codegen", "Code generation", PhaseTimers);
+
+    // Map the input file instead of copying it, the buffer must outlive the
+    // AST since every token and identifier points into it.
+    std::unique_ptr<llvm::MemoryBuffer> InputBuffer;
+    {
+        llvm::TimeRegion Region(TimePhases ? &LoadTimer : nullptr);
+        llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> BufferOrErr =
+            llvm::MemoryBuffer::getFileOrSTDIN(InputFilename);
+        if (std::error_code EC = BufferOrErr.getError())
+        {
+            llvm::errs() << "Error: Unable to open " << InputFilename << " file: " << EC.message() << "\n";
+            return 1;
+        }
+        InputBuffer = std::move(*BufferOrErr);
+    }
+
+    // Create a lexer object and initialize it with the input buffer.
+    Lexer Lex(InputBuffer->getBuffer());
+
+    if (LexOnly)
+    {
+        Token Tok;
+        uint64_t NumTokens = 0;
+        llvm::TimeRecord Start = llvm::TimeRecord::getCurrentTime(true);
+        for (Lex.next(Tok); !Tok.is(Token::eoi); Lex.next(Tok))
+            ++NumTokens;
+        double Seconds = llvm::TimeRecord::getCurrentTime(false).getWallTime() - Start.getWallTime();
+        size_t Bytes = InputBuffer->getBufferSize();
+        llvm::errs() << "Lexed " << NumTokens << " tokens (" << Bytes << " bytes) in "
+                     << llvm::format("%.6f", Seconds) << " s, "
+                     << llvm::format("%.3f", Seconds > 0 ? Bytes / Seconds / 1e9 : 0.0) << " GB/s\n";
+        return 0;
+    }
+
+    // Create the context that owns every AST node; the whole tree is freed
+    // with it in one go.
+    ASTContext Context;
+
+    int Result;
+    if (UseFlatAST)
+    {
+        // Build the flat form directly, the pointer tree is never made.
+        FlatParser Parser(Lex, Context);
+        llvm::Optional<FlatAST> Flat;
+        {
+            llvm::TimeRegion Region(TimePhases ? &ParseTimer : nullptr);
+            Flat = Parser.parse();
+        }
+        if (!Flat || Parser.hasError())
+        {
+            llvm::errs() << "Syntax errors occurred\n";
+            return 1;
+        }
+        if (TimePhases)
+            llvm::errs() << "Flat AST: " << Flat->size() << " nodes in " << Flat->getMemory() << " bytes\n";
+        Result = compile(*Flat, Context, SemaTimer, OptTimer, CodeGenTimer);
+    }
+    else
+    {
+        // Create a parser object and initialize it with the lexer.
+        Parser Parser(Lex, Context);
+
+        // Parse the input expression and generate an abstract syntax tree (AST).
+        AST *Tree;
+        {
+            llvm::TimeRegion Region(TimePhases ? &ParseTimer : nullptr);
+            Tree = Parser.parse();
+        }
+
+        // Check if parsing was successful or if there were any syntax errors.
+        if (!Tree || Parser.hasError())
+        {
+            llvm::errs() << "Syntax errors occurred\n";
+            return 1;
+        }
+        if (TimePhases)
+            llvm::errs() << "AST: " << Context.getTotalMemory() << " bytes\n";
+        Result = compile(Tree, Context, SemaTimer, OptTimer, CodeGenTimer);
+    }
+    if (Result)
+        return Result;
+
+    if (TimePhases)
+        PhaseTimers.print(llvm::errs(), /*ResetAfterPrint=*/true);
 
     // The program executed successfully.
     return 0;
@@ -1,9 +1,12 @@
 #ifndef AST_H
 #define AST_H
 
+#include "ASTContext.h"
+#include "llvm/Support/Casting.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/InitLLVM.h"
 #include "llvm/Support/raw_ostream.h"
+#include <algorithm>
 
 class AST; // Abstract Syntax Tree
 class ARK; // Top-level program
@@ -19,61 +22,77 @@ class Loop;
 class Conditions;
 class Final;
 
-class ASTVisitor
+class AST
 {
 public:
-    // Virtual visit functions for each AST node type
-    virtual void visit(AST &) {};
-    virtual void visit(ARK &) {};
-    virtual void visit(Statement &) {};
-    virtual void visit(Declare &) = 0;
-    virtual void visit(Assign &) = 0;
-    virtual void visit(Expr &) = 0;
-    virtual void visit(If &) {};
-    virtual void visit(Elif &) {};
-    virtual void visit(Else &) {};
-    virtual void visit(Conditions &) {};
-    virtual void visit(Condition &) {};
-    virtual void visit(Loop &) {};
-    virtual void visit(Final &) = 0;
-};
+    // Every node carries the kind of its most derived class, which drives
+    // StaticASTVisitor and LLVM-style isa/cast/dyn_cast.
+    enum ASTKind
+    {
+        AK_ARK,
+        AK_Declare,
+        AK_Assign,
+        AK_If,
+        AK_Elif,
+        AK_Else,
+        AK_Loop,
+        AK_Expr,
+        AK_Final,
+        AK_Conditions,
+        AK_Condition
+    };
+
+private:
+    const ASTKind Kind;
 
-class AST
-{
 public:
-    virtual ~AST() {}
-    virtual void accept(ASTVisitor &V) = 0;
+    AST(ASTKind Kind) : Kind(Kind) {}
+    AST(const AST &) = delete;
+    AST &operator=(const AST &) = delete;
+
+    ASTKind getASTKind() const { return Kind; }
+
+    // Nodes only live in the arena of an ASTContext and are never destroyed
+    // one by one, so they must stay trivially destructible.
+    void *operator new(size_t Size, ASTContext &Context)
+    {
+        return Context.allocate(Size, alignof(AST));
+    }
+    void operator delete(void *, ASTContext &) {}
+    void *operator new(size_t) = delete;
+    void operator delete(void *) = delete;
 };
 
+// Drops the elements of an arena list for which Pred returns true in one
+// stable pass and returns the shortened list.
+template <typename T, typename PredT>
+llvm::MutableArrayRef<T> eraseFromList(llvm::MutableArrayRef<T> List, PredT Pred)
+{
+    auto NewEnd = std::remove_if(List.begin(), List.end(), Pred);
+    return List.take_front(NewEnd - List.begin());
+}
+
 class ARK : public AST
 {
 private:
-    llvm::SmallVector<Statement *> statements; // Stores the list of Exprs
+    llvm::MutableArrayRef<Statement *> statements; // Stores the list of Exprs
 
 public:
-    ARK(llvm::SmallVector<Statement *> Statements) : statements(Statements) {}
-    llvm::SmallVector<Statement *> getStatements() { return statements; }
+    ARK(ASTContext &Context, llvm::ArrayRef<Statement *> Statements) : AST(AK_ARK), statements(Context.copyArray(Statements)) {}
+    llvm::MutableArrayRef<Statement *> getStatements() { return statements; }
 
-    llvm::SmallVector<Statement *>::const_iterator begin() { return statements.begin(); }
+    // replaces the statement list, e.g. after inlining a decided branch
+    void setStatements(ASTContext &Context, llvm::ArrayRef<Statement *> Statements) { statements = Context.copyArray(Statements); }
 
-    llvm::SmallVector<Statement *>::const_iterator end() { return statements.end(); }
+    llvm::ArrayRef<Statement *>::const_iterator begin() { return statements.begin(); }
 
-    llvm::SmallVector<Statement *> erase(Statement* statement) {
-        llvm::SmallVector<Statement *>::iterator iter = std::find(statements.begin(), statements.end(), statement);
+    llvm::ArrayRef<Statement *>::const_iterator end() { return statements.end(); }
 
-        // Check if the element was found
-        if (iter != statements.end()) {
-            // Erase the element from the vector
-            statements.erase(iter);
-        }
-
-        return statements;
-    }
+    // removes every statement for which Pred returns true
+    template <typename PredT>
+    void eraseStatementsIf(PredT Pred) { statements = eraseFromList(statements, Pred); }
 
-    virtual void accept(ASTVisitor &V) override
-    {
-        V.visit(*this);
-    }
+    static bool classof(const AST *N) { return N->getASTKind() == AK_ARK; }
 };
 
 class Statement : public AST
@@ -93,45 +112,51 @@ private:
 public:
     StatementType getKind() { return Type; }
 
-    Statement(StatementType type) : Type(type) {}
-    virtual void accept(ASTVisitor &V) override
-    {
-        V.visit(*this);
-    }
+    Statement(ASTKind Kind, StatementType type) : AST(Kind), Type(type) {}
+
+    static bool classof(const AST *N) { return N->getASTKind() >= AK_Declare && N->getASTKind() <= AK_Loop; }
 };
 
 class Declare : public Statement
 {
 private:
-    llvm::SmallVector<llvm::StringRef, 8> vars;
-    llvm::SmallVector<Expr *> exprs;
+    llvm::ArrayRef<llvm::StringRef> vars;
+    llvm::MutableArrayRef<unsigned> symbols; // symbol ID of each declared variable
+    llvm::MutableArrayRef<Expr *> exprs;
 
 public:
-    Declare(llvm::SmallVector<llvm::StringRef, 8> vars, llvm::SmallVector<Expr *> exprs) :
-        vars(vars), exprs(exprs), Statement(Statement::Declaration) {}
+    Declare(ASTContext &Context, llvm::ArrayRef<llvm::StringRef> vars, llvm::ArrayRef<Expr *> exprs) :
+        vars(Context.copyArray(vars)), exprs(Context.copyArray(exprs)), Statement(AK_Declare, Statement::Declaration)
+    {
+        symbols = Context.allocateArray<unsigned>(vars.size());
+        for (size_t I = 0, E = vars.size(); I != E; ++I)
+            symbols[I] = Context.intern(vars[I]);
+    }
 
-    llvm::SmallVector<llvm::StringRef, 8> getVars()
+    llvm::ArrayRef<llvm::StringRef> getVars()
     {
         return vars;
     }
 
-    llvm::SmallVector<Expr *> getExprs()
+    llvm::ArrayRef<unsigned> getSymbols()
+    {
+        return symbols;
+    }
+
+    llvm::MutableArrayRef<Expr *> getExprs()
     {
         return exprs;
     }
 
-    llvm::SmallVector<llvm::StringRef, 8>::const_iterator VarsBegin() { return vars.begin(); }
+    llvm::ArrayRef<llvm::StringRef>::const_iterator VarsBegin() { return vars.begin(); }
 
-    llvm::SmallVector<llvm::StringRef, 8>::const_iterator VarsEnd() { return vars.end(); }
+    llvm::ArrayRef<llvm::StringRef>::const_iterator VarsEnd() { return vars.end(); }
 
-    llvm::SmallVector<Expr *>::const_iterator ExprsBegin() { return exprs.begin(); }
+    llvm::ArrayRef<Expr *>::const_iterator ExprsBegin() { return exprs.begin(); }
 
-    llvm::SmallVector<Expr *>::const_iterator ExprsEnd() { return exprs.end(); }
+    llvm::ArrayRef<Expr *>::const_iterator ExprsEnd() { return exprs.end(); }
 
-    virtual void accept(ASTVisitor &V) override
-    {
-        V.visit(*this);
-    }
+    static bool classof(const AST *N) { return N->getASTKind() == AK_Declare; }
 };
 
 class Assign : public Statement
@@ -154,7 +179,7 @@ private:
 
 public:
     Assign(Final *Left, AssOp AssignmentOp, Expr *Right) :
-     Left(Left), AssignmentOp(AssignmentOp), Right(Right), Statement(StatementType::Assignment) {}
+     Left(Left), AssignmentOp(AssignmentOp), Right(Right), Statement(AK_Assign, StatementType::Assignment) {}
 
     Final *getLeft() { return Left; }
 
@@ -162,10 +187,10 @@ public:
 
     AssOp getAssignmentOP() { return AssignmentOp; }
 
-    virtual void accept(ASTVisitor &V) override
-    {
-        V.visit(*this);
-    }
+    // replaces the right-hand side, e.g. by a folded constant
+    void setRight(Expr *R, AssOp Op) { Right = R; AssignmentOp = Op; }
+
+    static bool classof(const AST *N) { return N->getASTKind() == AK_Assign; }
 };
 
 class Expr : public AST
@@ -178,20 +203,24 @@ public:
         Mul,
         Div,
         Mod,
-        Pow
+        Pow,
+        Shl // only made by the optimizer, from x * 2^k
     };
 
 private:
     Expr *Left = nullptr; 
     Operator Op;      
     Expr *Right = nullptr; 
+    // + - * cannot overflow, as in the source; cleared when the optimizer
+    // regroups operations whose intermediate results may wrap
+    bool NoSignedWrap = true;
 
 public:
     Expr(Expr *L, Operator Op, Expr *R) : 
-    Left(L), Op(Op), Right(R) {}
+    AST(AK_Expr), Left(L), Op(Op), Right(R) {}
     Expr(Expr *L) : 
-    Left(L) {}
-    Expr() {}
+    AST(AK_Expr), Left(L) {}
+    Expr(ASTKind Kind = AK_Expr) : AST(Kind) {}
 
     Expr *getLeft() { return Left; }
 
@@ -199,11 +228,16 @@ public:
 
     Expr *getRight() { return Right; }
 
+    void setLeft(Expr *L) { Left = L; }
+
+    void setRight(Expr *R) { Right = R; }
+
+    bool hasNoSignedWrap() { return NoSignedWrap; }
+
+    void setNoSignedWrap(bool NSW) { NoSignedWrap = NSW; }
+
+    static bool classof(const AST *N) { return N->getASTKind() == AK_Expr || N->getASTKind() == AK_Final; }
 
-    virtual void accept(ASTVisitor &V) override
-    {
-        V.visit(*this);
-    }
 };
 
 
@@ -222,10 +256,10 @@ private:
 
 public:
     Conditions(Condition *Left, Operator Sign, Conditions *Right) : 
-    Left(Left), Sign(Sign), Right(Right) {}
+    AST(AK_Conditions), Left(Left), Sign(Sign), Right(Right) {}
     Conditions(Condition *left) : 
-    Left(left) {}
-    Conditions() {}
+    AST(AK_Conditions), Left(left) {}
+    Conditions(ASTKind Kind = AK_Conditions) : AST(Kind) {}
 
     Condition *getLeft() { return Left; }
 
@@ -233,10 +267,11 @@ public:
 
     Conditions *getRight() { return Right; }
 
-    virtual void accept(ASTVisitor &V) override
-    {
-        V.visit(*this);
-    }
+    void setLeft(Condition *L) { Left = L; }
+
+    void setRight(Conditions *R) { Right = R; }
+
+    static bool classof(const AST *N) { return N->getASTKind() == AK_Conditions || N->getASTKind() == AK_Condition; }
 };
 
 class Condition : public Conditions
@@ -249,7 +284,10 @@ public:
         GreaterThan,
         GreaterEqual,
         EqualEqual,
-        NotEqual
+        NotEqual,
+        // only made by the optimizer
+        UnsignedLessEqual, // range checks, x - lo <=u hi - lo
+        BitTest            // bit Left of the mask Right is set; false past bit 31
     };
 
 private:
@@ -259,18 +297,21 @@ private:
 
 public:
     Condition(Expr *Left, Operator Op, Expr *Right) : 
-    Left(Left), Op(Op), Right(Right), Conditions() {}
+    Left(Left), Op(Op), Right(Right), Conditions(AK_Condition) {}
 
     Expr *getLeft() { return Left; }
 
     Operator getSign() { return Op; }
 
+    void setSign(Operator O) { Op = O; }
+
     Expr *getRight() { return Right; }
 
-    virtual void accept(ASTVisitor &V) override
-    {
-        V.visit(*this);
-    }
+    void setLeft(Expr *L) { Left = L; }
+
+    void setRight(Expr *R) { Right = R; }
+
+    static bool classof(const AST *N) { return N->getASTKind() == AK_Condition; }
 };
 
 class Final : public Expr
@@ -285,18 +326,22 @@ public:
 private:
   ValueKind Kind;                            
   llvm::StringRef Val;
+  unsigned Symbol = 0; // symbol ID of an identifier
+  int64_t Value = 0;   // value of a number, decoded once by the parser
 
 public:
-  Final(ValueKind Kind, llvm::StringRef Val) : Kind(Kind), Val(Val), Expr() {}
+  Final(ValueKind Kind, llvm::StringRef Val, unsigned Symbol = 0) : Expr(AK_Final), Kind(Kind), Val(Val), Symbol(Symbol) {}
+  Final(llvm::StringRef Val, int64_t Value) : Expr(AK_Final), Kind(Number), Val(Val), Value(Value) {}
 
   ValueKind getKind() { return Kind; }
 
   llvm::StringRef getVal() { return Val; }
 
-  virtual void accept(ASTVisitor &V) override
-  {
-    V.visit(*this);
-  }
+  unsigned getSymbol() { return Symbol; }
+
+  int64_t getValue() { return Value; }
+
+  static bool classof(const AST *N) { return N->getASTKind() == AK_Final; }
 };
 
 
@@ -304,103 +349,169 @@ class If : public Statement
 {
 private:
     Conditions *Conds;
-    llvm::SmallVector<Assign *> Assignments;
-    llvm::SmallVector<Elif *> Elifs;
+    llvm::MutableArrayRef<Assign *> Assignments;
+    llvm::MutableArrayRef<Elif *> Elifs;
     Else *ElseBranch;
 
 public:
-    If(Conditions *Conds, llvm::SmallVector<Assign *> Assignments,llvm::SmallVector<Elif *> Elifs, Else *ElseBranch) : 
-    Conds(Conds), Assignments(Assignments), Statement(Statement::If), Elifs(Elifs), ElseBranch(ElseBranch) {}
+    If(ASTContext &Context, Conditions *Conds, llvm::ArrayRef<Assign *> Assignments, llvm::ArrayRef<Elif *> Elifs, Else *ElseBranch) :
+    Conds(Conds), Assignments(Context.copyArray(Assignments)), Statement(AK_If, Statement::If), Elifs(Context.copyArray(Elifs)), ElseBranch(ElseBranch) {}
     
-    If() : Statement(Statement::If) {}
+    If(ASTKind Kind) : Statement(Kind, Statement::If) {}
 
     Conditions *getConds() { return Conds; }
 
-    llvm::SmallVector<Assign *> getAssignments() { return Assignments; }
+    void setConds(Conditions *C) { Conds = C; }
+
+    llvm::MutableArrayRef<Assign *> getAssignments() { return Assignments; }
+
+    llvm::ArrayRef<Assign *>::const_iterator AssignmentsBegin() { return Assignments.begin(); }
+
+    llvm::ArrayRef<Assign *>::const_iterator AssignmentsEnd() { return Assignments.end(); }
 
-    llvm::SmallVector<Assign *>::const_iterator AssignmentsBegin() { return Assignments.begin(); }
+    // removes every assignment of the body for which Pred returns true
+    template <typename PredT>
+    void eraseAssignmentsIf(PredT Pred) { Assignments = eraseFromList(Assignments, Pred); }
 
-    llvm::SmallVector<Assign *>::const_iterator AssignmentsEnd() { return Assignments.end(); }
+    // replaces the body, e.g. after inserting assignments to temporaries
+    void setAssignments(ASTContext &Context, llvm::ArrayRef<Assign *> List) { Assignments = Context.copyArray(List); }
 
-    llvm::SmallVector<Elif *> getElifs() { return Elifs; }
+    llvm::MutableArrayRef<Elif *> getElifs() { return Elifs; }
 
-    llvm::SmallVector<Elif *>::const_iterator ElifsBegin() { return Elifs.begin(); }
+    llvm::ArrayRef<Elif *>::const_iterator ElifsBegin() { return Elifs.begin(); }
 
-    llvm::SmallVector<Elif *>::const_iterator ElifsEnd() { return Elifs.end(); }
+    llvm::ArrayRef<Elif *>::const_iterator ElifsEnd() { return Elifs.end(); }
 
     Else *getElse() { return ElseBranch; }
 
-    virtual void accept(ASTVisitor &V) override { V.visit(*this); }
+    void setElse(Else *E) { ElseBranch = E; }
+
+    // drops the last N elif arms
+    void dropElifs(size_t N) { Elifs = Elifs.drop_back(N); }
+
+    static bool classof(const AST *N) { return N->getASTKind() >= AK_If && N->getASTKind() <= AK_Else; }
 };
 
 class Elif : public If
 {
 private:
     Conditions *Conds;
-    llvm::SmallVector<Assign *> Assignments;
+    llvm::MutableArrayRef<Assign *> Assignments;
 
 public:
-    Elif(Conditions *Conds, llvm::SmallVector<Assign *> Assignments) :
-     Conds(Conds), Assignments(Assignments), If() {}
+    Elif(ASTContext &Context, Conditions *Conds, llvm::ArrayRef<Assign *> Assignments) :
+     Conds(Conds), Assignments(Context.copyArray(Assignments)), If(AK_Elif) {}
 
     Conditions *getConds() { return Conds; }
 
-    llvm::SmallVector<Assign *> getAssignments() { return Assignments; }
+    void setConds(Conditions *C) { Conds = C; }
 
-    llvm::SmallVector<Assign *>::const_iterator AssignmentsBegin() { return Assignments.begin(); }
+    llvm::MutableArrayRef<Assign *> getAssignments() { return Assignments; }
 
-    llvm::SmallVector<Assign *>::const_iterator AssignmentsEnd() { return Assignments.end(); }
+    llvm::ArrayRef<Assign *>::const_iterator AssignmentsBegin() { return Assignments.begin(); }
 
-    virtual void accept(ASTVisitor &V) override
-    {
-        V.visit(*this);
-    }
+    llvm::ArrayRef<Assign *>::const_iterator AssignmentsEnd() { return Assignments.end(); }
+
+    // removes every assignment of the body for which Pred returns true
+    template <typename PredT>
+    void eraseAssignmentsIf(PredT Pred) { Assignments = eraseFromList(Assignments, Pred); }
+
+    // replaces the body, e.g. after inserting assignments to temporaries
+    void setAssignments(ASTContext &Context, llvm::ArrayRef<Assign *> List) { Assignments = Context.copyArray(List); }
 };
 
 class Else : public If
 {
 private:
-    llvm::SmallVector<Assign *> Assignments;
+    llvm::MutableArrayRef<Assign *> Assignments;
 
 public:
-    Else(llvm::SmallVector<Assign *> Assignments) : 
-    Assignments(Assignments), If() {}
+    Else(ASTContext &Context, llvm::ArrayRef<Assign *> Assignments) :
+    Assignments(Context.copyArray(Assignments)), If(AK_Else) {}
 
-    llvm::SmallVector<Assign *> getAssignments() { return Assignments; }
+    llvm::MutableArrayRef<Assign *> getAssignments() { return Assignments; }
 
-    llvm::SmallVector<Assign *>::const_iterator AssignmentsBegin() { return Assignments.begin(); }
+    llvm::ArrayRef<Assign *>::const_iterator AssignmentsBegin() { return Assignments.begin(); }
 
-    llvm::SmallVector<Assign *>::const_iterator AssignmentsEnd() { return Assignments.end(); }
+    llvm::ArrayRef<Assign *>::const_iterator AssignmentsEnd() { return Assignments.end(); }
 
+    // removes every assignment of the body for which Pred returns true
+    template <typename PredT>
+    void eraseAssignmentsIf(PredT Pred) { Assignments = eraseFromList(Assignments, Pred); }
+
+    // replaces the body, e.g. after inserting assignments to temporaries
+    void setAssignments(ASTContext &Context, llvm::ArrayRef<Assign *> List) { Assignments = Context.copyArray(List); }
 
-virtual void accept(ASTVisitor &V) override
-    {
-        V.visit(*this);
-    }
 };
 
 class Loop : public Statement
 {
 private:
     Conditions *Conds;
-    llvm::SmallVector<Assign *> Assignments;
+    llvm::MutableArrayRef<Assign *> Assignments;
 
 public:
-    Loop(Conditions *Conds, llvm::SmallVector<Assign *> Assignments) : 
-    Conds(Conds), Assignments(Assignments), Statement(Statement::Loop) {}
+    Loop(ASTContext &Context, Conditions *Conds, llvm::ArrayRef<Assign *> Assignments) :
+    Conds(Conds), Assignments(Context.copyArray(Assignments)), Statement(AK_Loop, Statement::Loop) {}
 
     Conditions *getConds() { return Conds; }
 
-    llvm::SmallVector<Assign *> getAssignments() { return Assignments; }
+    void setConds(Conditions *C) { Conds = C; }
 
-    llvm::SmallVector<Assign *>::const_iterator AssignmentsBegin() { return Assignments.begin(); }
+    llvm::MutableArrayRef<Assign *> getAssignments() { return Assignments; }
 
-    llvm::SmallVector<Assign *>::const_iterator AssignmentsEnd() { return Assignments.end(); }
+    llvm::ArrayRef<Assign *>::const_iterator AssignmentsBegin() { return Assignments.begin(); }
 
-    virtual void accept(ASTVisitor &V) override
+    llvm::ArrayRef<Assign *>::const_iterator AssignmentsEnd() { return Assignments.end(); }
+
+    // removes every assignment of the body for which Pred returns true
+    template <typename PredT>
+    void eraseAssignmentsIf(PredT Pred) { Assignments = eraseFromList(Assignments, Pred); }
+
+    // replaces the body, e.g. after inserting assignments to temporaries
+    void setAssignments(ASTContext &Context, llvm::ArrayRef<Assign *> List) { Assignments = Context.copyArray(List); }
+};
+
+// Visitor dispatched at compile time: dispatch() switches on the node kind and
+// calls the matching visit() of Derived directly, so the calls can be inlined
+// instead of going through a vtable per node. Derived classes override the
+// visit() overloads they need and pull in the rest with
+// "using StaticASTVisitor<Derived>::visit;".
+template <typename Derived>
+class StaticASTVisitor
+{
+public:
+    void dispatch(AST *Node)
     {
-        V.visit(*this);
+        Derived &D = *static_cast<Derived *>(this);
+        switch (Node->getASTKind())
+        {
+        case AST::AK_ARK: return D.visit(*llvm::cast<ARK>(Node));
+        case AST::AK_Declare: return D.visit(*llvm::cast<Declare>(Node));
+        case AST::AK_Assign: return D.visit(*llvm::cast<Assign>(Node));
+        case AST::AK_If: return D.visit(*llvm::cast<If>(Node));
+        case AST::AK_Elif: return D.visit(*llvm::cast<Elif>(Node));
+        case AST::AK_Else: return D.visit(*llvm::cast<Else>(Node));
+        case AST::AK_Loop: return D.visit(*llvm::cast<Loop>(Node));
+        case AST::AK_Expr: return D.visit(*llvm::cast<Expr>(Node));
+        case AST::AK_Final: return D.visit(*llvm::cast<Final>(Node));
+        case AST::AK_Conditions: return D.visit(*llvm::cast<Conditions>(Node));
+        case AST::AK_Condition: return D.visit(*llvm::cast<Condition>(Node));
+        }
     }
+
+    // default visit functions do nothing
+    void visit(ARK &) {}
+    void visit(Declare &) {}
+    void visit(Assign &) {}
+    void visit(If &) {}
+    void visit(Elif &) {}
+    void visit(Else &) {}
+    void visit(Loop &) {}
+    void visit(Expr &) {}
+    void visit(Final &) {}
+    void visit(Conditions &) {}
+    void visit(Condition &) {}
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,93 @@
+#ifndef ASTCONTEXT_H
+#define ASTCONTEXT_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/Allocator.h"
+#include <memory>
+#include <vector>
+
+// Owns the memory of every AST node and child array of one program. Nodes are
+// bump-allocated next to each other and are never freed one by one; the whole
+// tree goes away at once with reset() or when the context is destroyed.
+//
+// It also interns identifiers: every distinct name gets a dense symbol ID, so
+// later phases index flat vectors and bitsets instead of hashing strings.
+class ASTContext
+{
+    llvm::BumpPtrAllocator Allocator;
+    llvm::StringMap<unsigned> SymbolIDs;
+    std::vector<llvm::StringRef> SymbolNames;
+
+public:
+    ASTContext() = default;
+    ASTContext(const ASTContext &) = delete;
+    ASTContext &operator=(const ASTContext &) = delete;
+
+    void *allocate(size_t Size, size_t Alignment)
+    {
+        return Allocator.Allocate(Size, Alignment);
+    }
+
+    // allocates an uninitialized array of trivial elements in the arena
+    template <typename T>
+    llvm::MutableArrayRef<T> allocateArray(size_t Size)
+    {
+        if (Size == 0)
+            return llvm::MutableArrayRef<T>();
+        return llvm::MutableArrayRef<T>(Allocator.Allocate<T>(Size), Size);
+    }
+
+    // copies a child list into the arena
+    template <typename T>
+    llvm::MutableArrayRef<T> copyArray(llvm::ArrayRef<T> Source)
+    {
+        if (Source.empty())
+            return llvm::MutableArrayRef<T>();
+        T *Mem = Allocator.Allocate<T>(Source.size());
+        std::uninitialized_copy(Source.begin(), Source.end(), Mem);
+        return llvm::MutableArrayRef<T>(Mem, Source.size());
+    }
+
+    // returns the symbol ID of Name, assigning the next free one on first use
+    unsigned intern(llvm::StringRef Name)
+    {
+        auto Inserted = SymbolIDs.try_emplace(Name, SymbolNames.size());
+        if (Inserted.second)
+            SymbolNames.push_back(Inserted.first->getKey());
+        return Inserted.first->getValue();
+    }
+
+    // copies Text into the arena, for literals made up after parsing
+    llvm::StringRef copyString(llvm::StringRef Text)
+    {
+        llvm::MutableArrayRef<char> Mem = copyArray(llvm::ArrayRef<char>(Text.data(), Text.size()));
+        return llvm::StringRef(Mem.data(), Mem.size());
+    }
+
+    // returns the symbol ID of Name, or None if the program never names it
+    llvm::Optional<unsigned> lookup(llvm::StringRef Name) const
+    {
+        auto It = SymbolIDs.find(Name);
+        if (It == SymbolIDs.end())
+            return llvm::None;
+        return It->getValue();
+    }
+
+    llvm::StringRef getSymbolName(unsigned Symbol) const { return SymbolNames[Symbol]; }
+
+    unsigned getNumSymbols() const { return SymbolNames.size(); }
+
+    // frees every node allocated so far in one call
+    void reset()
+    {
+        Allocator.Reset();
+        SymbolIDs.clear();
+        SymbolNames.clear();
+    }
+
+    size_t getTotalMemory() const { return Allocator.getTotalMemory(); }
+};
+
+#endif
@@ -1,7 +1,8 @@
 #include "CodeGen.h"
-#include "llvm/ADT/StringMap.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/LLVMContext.h"
+#include "llvm/Support/DivisionByConstantInfo.h"
+#include "llvm/Support/MathExtras.h"
 #include "llvm/Support/raw_ostream.h"
 
 using namespace llvm;
@@ -9,31 +10,201 @@ using namespace llvm;
 // Define a visitor class for generating LLVM IR from the AST.
 namespace ns
 {
-  class ToIRVisitor : public ASTVisitor
+  // Comparisons costing at most this are evaluated without a branch when
+  // they cannot trap; a mispredicted branch costs more than a few
+  // arithmetic instructions.
+  constexpr unsigned CheapCost = 4;
+
+  // Rough cost of evaluating E in instructions. MayTrap is set if E
+  // divides by a divisor that may be 0 or -1, so it must not be
+  // evaluated speculatively.
+  unsigned getCost(Expr *E, bool &MayTrap)
   {
+    if (isa<Final>(E))
+      return 0;
+    if (!E->getRight())
+      return getCost(E->getLeft(), MayTrap);
+    unsigned Operands = getCost(E->getLeft(), MayTrap) + getCost(E->getRight(), MayTrap);
+    Final *R = dyn_cast<Final>(E->getRight());
+    bool ConstantR = R && R->getKind() == Final::Number;
+    switch (E->getOperator())
+    {
+    case Expr::Plus:
+    case Expr::Minus:
+    case Expr::Shl:
+      return Operands + 1;
+    case Expr::Mul:
+      return Operands + 3;
+    case Expr::Div:
+    case Expr::Mod:
+      if (ConstantR && R->getValue() != 0 && R->getValue() != -1)
+        return Operands + 5;
+      MayTrap = true;
+      return Operands + 20;
+    case Expr::Pow:
+      // square-and-multiply, or a call to ark_ipow
+      return Operands + (ConstantR ? 3 * (Log2_64(std::max<int64_t>(R->getValue(), 1)) + 1) : 30);
+    }
+    return Operands;
+  }
+
+  unsigned getCost(Conditions *C, bool &MayTrap)
+  {
+    unsigned Cost = 0;
+    for (; C; C = C->getRight())
+    {
+      Condition *Cond = dyn_cast<Condition>(C);
+      if (!Cond)
+        Cond = C->getLeft();
+      Cost += getCost(Cond->getLeft(), MayTrap) + getCost(Cond->getRight(), MayTrap) +
+              (Cond->getSign() == Condition::BitTest ? 4 : 1);
+      if (isa<Condition>(C))
+        break;
+    }
+    return Cost;
+  }
+
+  // How likely the comparison C is to decide a chain joined by Sign on
+  // its own, lower first: an equality is rarely true, an inequality
+  // rarely false.
+  unsigned getSelectivityRank(Conditions *C, Conditions::Operator Sign)
+  {
+    Condition *Cond = dyn_cast<Condition>(C);
+    if (!Cond)
+      return 1;
+    unsigned Rank;
+    switch (Cond->getSign())
+    {
+    case Condition::EqualEqual:
+    case Condition::BitTest:
+      Rank = 0;
+      break;
+    case Condition::NotEqual:
+      Rank = 2;
+      break;
+    default:
+      Rank = 1;
+    }
+    return Sign == Conditions::And ? Rank : 2 - Rank;
+  }
+
+  // What the code generators for the pointer tree and the flat form share:
+  // the runtime functions, the stack slots of the variables and the
+  // lowering of operators and assignments.
+  class IRLowering
+  {
+  protected:
     Module *M;
     IRBuilder<> Builder;
     Type *VoidTy;
     Type *Int32Ty;
+    Type *Int64Ty;
     Type *Int8PtrTy;
     Type *Int8PtrPtrTy;
     Constant *Int32Zero;
 
-    Value *V;
-    StringMap<AllocaInst *> nameMap;
+    std::vector<AllocaInst *> nameMap; // stack slot of each variable, indexed by symbol ID
 
     llvm::FunctionType* MainFty;
     llvm::Function* MainFn;
 
     FunctionType *CalcWriteFnTy;
     Function *CalcWriteFn;
-  public:
-    // Constructor for the visitor class.
-    ToIRVisitor(Module *M) : M(M), Builder(M->getContext())
+
+    FunctionType *PowFnTy;
+    Function *PowFn;
+
+    const OutputSet &Outputs;
+
+    // Prints the new value of Symbol if writes to it are observable.
+    void emitWrite(unsigned Symbol, Value *Val)
+    {
+      if (Outputs.contains(Symbol))
+        Builder.CreateCall(CalcWriteFnTy, CalcWriteFn, {Val});
+    }
+
+    // Returns the divisor if R is a constant that division can be strength
+    // reduced for; 0, 1, -1 and INT_MIN are left to the generic paths.
+    Optional<int32_t> getReducibleDivisor(Value *R)
+    {
+      ConstantInt *C = dyn_cast<ConstantInt>(R);
+      if (!C || C->isZero() || C->isOne() || C->isMinusOne() || C->isMinValue(true))
+        return None;
+      return (int32_t)C->getSExtValue();
+    }
+
+    // Rounding bias for a power-of-two divisor 2^K: 2^K - 1 for a negative
+    // dividend and 0 otherwise, so that the shift rounds toward zero.
+    Value *emitPow2Bias(Value *L, unsigned K)
+    {
+      Value *Sign = Builder.CreateAShr(L, 31);
+      return Builder.CreateLShr(Sign, 32 - K);
+    }
+
+    // Signed division, without a divide instruction for a constant divisor:
+    // a power of two becomes shifts, any other divisor a multiply by its
+    // magic number keeping the high half.
+    Value *emitSDiv(Value *L, Value *R)
+    {
+      ConstantInt *C = dyn_cast<ConstantInt>(R);
+      if (C && C->isOne())
+        return L;
+      if (C && C->isMinusOne())
+        return Builder.CreateNSWNeg(L);
+      Optional<int32_t> D = getReducibleDivisor(R);
+      if (!D)
+        return Builder.CreateSDiv(L, R);
+
+      uint32_t AbsD = *D < 0 ? -(uint32_t)*D : *D;
+      if (isPowerOf2_32(AbsD))
+      {
+        unsigned K = Log2_32(AbsD);
+        Value *Q = Builder.CreateAShr(Builder.CreateAdd(L, emitPow2Bias(L, K)), K);
+        return *D < 0 ? Builder.CreateNeg(Q) : Q;
+      }
+
+      SignedDivisionByConstantInfo Magic = SignedDivisionByConstantInfo::get(C->getValue());
+      Value *Wide = Builder.CreateMul(Builder.CreateSExt(L, Int64Ty),
+                                      ConstantInt::get(Int64Ty, Magic.Magic.getSExtValue()));
+      Value *Q = Builder.CreateTrunc(Builder.CreateAShr(Wide, 32), Int32Ty);
+      if (*D > 0 && Magic.Magic.isNegative())
+        Q = Builder.CreateAdd(Q, L);
+      if (*D < 0 && Magic.Magic.isStrictlyPositive())
+        Q = Builder.CreateSub(Q, L);
+      if (Magic.ShiftAmount)
+        Q = Builder.CreateAShr(Q, Magic.ShiftAmount);
+      // round a negative quotient toward zero
+      return Builder.CreateAdd(Q, Builder.CreateLShr(Q, 31));
+    }
+
+    // Signed remainder, with the sign of the dividend. A constant divisor
+    // reuses the division sequence; a power of two only needs a mask.
+    Value *emitSRem(Value *L, Value *R)
+    {
+      ConstantInt *C = dyn_cast<ConstantInt>(R);
+      if (C && (C->isOne() || C->isMinusOne()))
+        return Int32Zero;
+      Optional<int32_t> D = getReducibleDivisor(R);
+      if (!D)
+        return Builder.CreateSRem(L, R);
+
+      uint32_t AbsD = *D < 0 ? -(uint32_t)*D : *D;
+      if (isPowerOf2_32(AbsD))
+      {
+        unsigned K = Log2_32(AbsD);
+        Value *Rounded = Builder.CreateAnd(Builder.CreateAdd(L, emitPow2Bias(L, K)), -(int64_t)AbsD);
+        return Builder.CreateSub(L, Rounded);
+      }
+      return Builder.CreateSub(L, Builder.CreateMul(emitSDiv(L, R), R));
+    }
+
+    IRLowering(Module *M, ASTContext &Context, const OutputSet &Outputs)
+        : M(M), Builder(M->getContext()), nameMap(Context.getNumSymbols()), Outputs(Outputs)
     {
       // Initialize LLVM types and constants.
       VoidTy = Type::getVoidTy(M->getContext());
       Int32Ty = Type::getInt32Ty(M->getContext());
+      Int64Ty = Type::getInt64Ty(M->getContext());
       Int8PtrTy = Type::getInt8PtrTy(M->getContext());
       Int8PtrPtrTy = Int8PtrTy->getPointerTo();
       Int32Zero = ConstantInt::get(Int32Ty, 0, true);
@@ -42,291 +213,515 @@ namespace ns
       CalcWriteFnTy = FunctionType::get(VoidTy, {Int32Ty}, false);
       // Create a function declaration for the "gsm_write" function.
       CalcWriteFn = Function::Create(CalcWriteFnTy, GlobalValue::ExternalLinkage, "ark_write", M);
+
+      // Declare the runtime helper that raises to an exponent only known at runtime.
+      PowFnTy = FunctionType::get(Int32Ty, {Int32Ty, Int32Ty}, false);
+      PowFn = Function::Create(PowFnTy, GlobalValue::ExternalLinkage, "ark_ipow", M);
+      PowFn->setDoesNotAccessMemory();
+      PowFn->setDoesNotThrow();
     }
 
-    // Entry point for generating LLVM IR from the AST.
-    void run(AST *Tree)
+    // Starts the main function; the caller fills it in and calls endMain.
+    void beginMain()
     {
       // Create the main function with the appropriate function type.
-      FunctionType *MainFty = FunctionType::get(Int32Ty, {Int32Ty, Int8PtrPtrTy}, false);
-      Function *MainFn = Function::Create(MainFty, GlobalValue::ExternalLinkage, "main", M);
+      MainFty = FunctionType::get(Int32Ty, {Int32Ty, Int8PtrPtrTy}, false);
+      MainFn = Function::Create(MainFty, GlobalValue::ExternalLinkage, "main", M);
 
       // Create a basic block for the entry point of the main function.
       BasicBlock *BB = BasicBlock::Create(M->getContext(), "entry", MainFn);
       Builder.SetInsertPoint(BB);
+    }
 
-      // Visit the root node of the AST to generate IR.
-      Tree->accept(*this);
-
+    void endMain()
+    {
       // Create a return instruction at the end of the main function.
       Builder.CreateRet(Int32Zero);
-
     }
 
-    // Visit function for the ARK node in the AST.
-    virtual void visit(ARK &Node) override
+    // Left Op Right; NSW is whether an add, sub, mul or shl keeps its
+    // overflow flag.
+    Value *emitBinary(Expr::Operator Op, Value *Left, Value *Right, bool NSW)
     {
-      // Iterate over the children of the MSM node and visit each child.
-      for (llvm::SmallVector<Statement *>::const_iterator I = Node.begin(), E = Node.end(); I != E; ++I)
+      Value *V = nullptr;
+      switch (Op)
       {
-        (*I)->accept(*this);
+        case Expr::Plus:
+        {
+          V = Builder.CreateAdd(Left, Right, "", false, NSW);
+          break;
+        }
+        case Expr::Minus:
+        {
+          V = Builder.CreateSub(Left, Right, "", false, NSW);
+          break;
+        }
+        case Expr::Mul:
+        {
+          V = Builder.CreateMul(Left, Right, "", false, NSW);
+          break;
+        }
+        case Expr::Div:
+        {
+          V = emitSDiv(Left, Right);
+          break;
+        }
+        case Expr::Pow:
+        {
+          ConstantInt *Exponent = dyn_cast<ConstantInt>(Right);
+          if (!Exponent)
+          {
+            // The exponent is only known at runtime.
+            V = Builder.CreateCall(PowFnTy, PowFn, {Left, Right});
+            break;
+          }
+          // Square-and-multiply: one multiply per bit of the exponent and
+          // one per set bit. A negative exponent counts as zero, as in
+          // ark_ipow. The squares never exceed the result, so they keep nsw.
+          int64_t N = Exponent->getSExtValue();
+          Value *Result = nullptr;
+          for (Value *Square = Left; N > 0; N >>= 1)
+          {
+            if (N & 1)
+              Result = Result ? Builder.CreateNSWMul(Result, Square) : Square;
+            if (N > 1)
+              Square = Builder.CreateNSWMul(Square, Square);
+          }
+          V = Result ? Result : ConstantInt::get(Int32Ty, 1, true);
+          break;
+        }
+        case Expr::Mod:
+        {
+          V = emitSRem(Left, Right);
+          break;
+        }
+        case Expr::Shl:
+        {
+          // x * 2^k with the multiply's overflow flag
+          V = Builder.CreateShl(Left, Right, "", false, NSW);
+          break;
+        }
       }
-    };
+      return V;
+    }
 
-virtual void visit(Assign &Node) override
+    // The i1 result of comparing Left with Right.
+    Value *emitCompare(Condition::Operator Op, Value *Left, Value *Right)
     {
-      // Visit the right-hand side of the assignment and get its value.
-      Node.getRight()->accept(*this);
-      Value *val = V;
+      Value *V = nullptr;
+      switch (Op)
+      {
+        case Condition::LessEqual:
+        {
+          V = Builder.CreateICmpSLE(Left, Right);
+          break;
+        }
+        case Condition::LessThan:
+        {
+          V = Builder.CreateICmpSLT(Left, Right);
+          break;
+        }
+        case Condition::GreaterThan:
+        {
+          V = Builder.CreateICmpSGT(Left, Right);
+          break;
+        }
+        case Condition::GreaterEqual:
+        {
+          V = Builder.CreateICmpSGE(Left, Right);
+          break;
+        }
+        case Condition::EqualEqual:
+        {
+          V = Builder.CreateICmpEQ(Left, Right);
+          break;
+        }
+        case Condition::NotEqual:
+        {
+          V = Builder.CreateICmpNE(Left, Right);
+          break;
+        }
+        case Condition::UnsignedLessEqual:
+        {
+          V = Builder.CreateICmpULE(Left, Right);
+          break;
+        }
+        case Condition::BitTest:
+        {
+          // (mask >> (bit & 31)) & 1, and false for a bit past 31
+          Value *InRange = Builder.CreateICmpULT(Left, ConstantInt::get(Int32Ty, 32));
+          Value *Shifted = Builder.CreateLShr(Right, Builder.CreateAnd(Left, 31));
+          Value *IsSet = Builder.CreateTrunc(Shifted, Builder.getInt1Ty());
+          V = Builder.CreateAnd(InRange, IsSet);
+          break;
+        }
+      }
+      return V;
+    }
 
-      // Get the name of the variable being assigned.
-      llvm::StringRef varName = Node.getLeft()->getVal();
+    // Stores val, or the old value of Symbol combined with val, to Symbol.
+    void emitAssign(Assign::AssOp Op, unsigned Symbol, Value *val)
+    {
+      // Get the stack slot of the variable being assigned.
+      AllocaInst *varSlot = nameMap[Symbol];
 
-      switch (Node.getAssignmentOP())
+      switch (Op)
       {
       case Assign::EqualAssign:
       {
         // Create a store instruction to assign the value to the variable.
-        Builder.CreateStore(val, nameMap[varName]);
+        Builder.CreateStore(val, varSlot);
 
-        // Create a call instruction to invoke the "gsm_write" function with the value.
-        Builder.CreateCall(CalcWriteFnTy, CalcWriteFn, {val});
+        // Print the value if the variable is an output.
+        emitWrite(Symbol, val);
 
         break;
       }
       case Assign::PlusAssign :
       {
         // Create a load instruction to get the current value of the variable.
-        Value *oldVal = Builder.CreateLoad(Int32Ty, nameMap[varName]);
+        Value *oldVal = Builder.CreateLoad(Int32Ty, varSlot);
 
         // Create an add instruction to add the old value and the new value.
         Value *newVal = Builder.CreateNSWAdd(oldVal, val);
 
         // Create a store instruction to assign the new value to the variable.
-        Builder.CreateStore(newVal, nameMap[varName]);
+        Builder.CreateStore(newVal, varSlot);
 
-        // Create a call instruction to invoke the "gsm_write" function with the new value.
-        CallInst *Call2 = Builder.CreateCall(CalcWriteFnTy, CalcWriteFn, {newVal});
+        // Print the new value if the variable is an output.
+        emitWrite(Symbol, newVal);
 
         break;
       }
       case Assign::MinusAssign:
       {
         // Create a load instruction to get the current value of the variable.
-        Value *oldVal2 = Builder.CreateLoad(Int32Ty, nameMap[varName]);
+        Value *oldVal2 = Builder.CreateLoad(Int32Ty, varSlot);
 
         // Create a sub instruction to subtract the old value and the new value.
         Value *newVal2 = Builder.CreateNSWSub(oldVal2, val);
 
         // Create a store instruction to assign the new value to the variable.
-        Builder.CreateStore(newVal2, nameMap[varName]);
+        Builder.CreateStore(newVal2, varSlot);
 
-        // Create a call instruction to invoke the "gsm_write" function with the new value.
-        CallInst *Call3 = Builder.CreateCall(CalcWriteFnTy, CalcWriteFn, {newVal2});
+        // Print the new value if the variable is an output.
+        emitWrite(Symbol, newVal2);
 
         break;
       }
       case Assign::MulAssign:
         {
         // Create a load instruction to get the current value of the variable.
-        Value *oldVal3 = Builder.CreateLoad(Int32Ty, nameMap[varName]);
+        Value *oldVal3 = Builder.CreateLoad(Int32Ty, varSlot);
 
         // Create a mul instruction to multiply the old value and the new value.
         Value *newVal3 = Builder.CreateNSWMul(oldVal3, val);
 
         // Create a store instruction to assign the new value to the variable.
-        Builder.CreateStore(newVal3, nameMap[varName]);
+        Builder.CreateStore(newVal3, varSlot);
 
-        // Create a call instruction to invoke the "gsm_write" function with the new value.
-        CallInst *Call4 = Builder.CreateCall(CalcWriteFnTy, CalcWriteFn, {newVal3});
+        // Print the new value if the variable is an output.
+        emitWrite(Symbol, newVal3);
 
         break;
         }
       case Assign::DivAssign:
       {
         // Create a load instruction to get the current value of the variable.
-        Value *oldVal4 = Builder.CreateLoad(Int32Ty, nameMap[varName]);
+        Value *oldVal4 = Builder.CreateLoad(Int32Ty, varSlot);
         // Create a div instruction to divide the old value and the new value.
-        Value *newVal4 = Builder.CreateSDiv(oldVal4, val);
+        Value *newVal4 = emitSDiv(oldVal4, val);
         // Create a store instruction to assign the new value to the variable.
-        Builder.CreateStore(newVal4, nameMap[varName]);
-        // Create a call instruction to invoke the "gsm_write" function with the new value.
-        CallInst *Call5 = Builder.CreateCall(CalcWriteFnTy, CalcWriteFn, {newVal4});
+        Builder.CreateStore(newVal4, varSlot);
+        // Print the new value if the variable is an output.
+        emitWrite(Symbol, newVal4);
         break;
       }
       case Assign::ModAssign:
       {
-        Value *oldVal5 = Builder.CreateLoad(Int32Ty, nameMap[varName]);
-        Value *newVal5 = Builder.CreateSRem(oldVal5, val);
-        Builder.CreateStore(newVal5, nameMap[varName]);
-        CallInst *Call6 = Builder.CreateCall(CalcWriteFnTy, CalcWriteFn, {newVal5});
+        Value *oldVal5 = Builder.CreateLoad(Int32Ty, varSlot);
+        Value *newVal5 = emitSRem(oldVal5, val);
+        Builder.CreateStore(newVal5, varSlot);
+        emitWrite(Symbol, newVal5);
         break;
       }
       }
+    }
+  };
+
+  class ToIRVisitor : public StaticASTVisitor<ToIRVisitor>, IRLowering
+  {
+    Value *V;
+
+    // One operand of an and/or chain, which may itself be a chain joined by
+    // the other operator.
+    struct ChainOperand
+    {
+      Conditions *C;
+      unsigned Cost;
+      bool MayTrap;
     };
 
-    virtual void visit(Final &Node) override
+    // Splits the chain starting at Conds into its operands joined by the
+    // operator of Conds. Between operands that may trap, the others are
+    // ordered cheapest and most selective first; they have no effects, so
+    // only operands that may trap must keep their order and keep running
+    // only when the ones before them do.
+    void getOperands(Conditions *Conds, SmallVectorImpl<ChainOperand> &Operands)
+    {
+      Conditions::Operator Sign = Conds->getSign();
+      for (Conditions *C = Conds;; C = C->getRight())
+      {
+        Conditions *Operand = C->getLeft();
+        Conditions *Rest = C->getRight();
+        bool Last = isa<Condition>(Rest) || Rest->getSign() != Sign;
+        for (Conditions *O : {Operand, Last ? Rest : nullptr})
+        {
+          if (!O)
+            continue;
+          bool MayTrap = false;
+          unsigned Cost = getCost(O, MayTrap);
+          Operands.push_back({O, Cost, MayTrap});
+        }
+        if (Last)
+          break;
+      }
+
+      auto Begin = Operands.begin();
+      while (Begin != Operands.end())
+      {
+        auto End = std::find_if(Begin, Operands.end(), [](const ChainOperand &O) { return O.MayTrap; });
+        std::stable_sort(Begin, End, [&](const ChainOperand &A, const ChainOperand &B) {
+          unsigned RankA = getSelectivityRank(A.C, Sign), RankB = getSelectivityRank(B.C, Sign);
+          return A.Cost != B.Cost ? A.Cost < B.Cost : RankA < RankB;
+        });
+        Begin = End == Operands.end() ? End : End + 1;
+      }
+    }
+
+    // Branches to True or False on Conds. Operands of an and/or chain that
+    // are cheap and cannot trap are combined without branching; before any
+    // other operand the chain branches, so it only runs when the operands
+    // before it do not decide the result.
+    void emitBranch(Conditions *Conds, BasicBlock *True, BasicBlock *False)
+    {
+      if (Condition *C = dyn_cast<Condition>(Conds))
+      {
+        dispatch(C);
+        Builder.CreateCondBr(V, True, False);
+        return;
+      }
+
+      bool IsAnd = Conds->getSign() == Conditions::And;
+      SmallVector<ChainOperand, 8> Operands;
+      getOperands(Conds, Operands);
+      Function *Fn = Builder.GetInsertBlock()->getParent();
+      Value *Decided = nullptr; // the operands combined so far
+      for (size_t I = 0; I < Operands.size(); ++I)
+      {
+        const ChainOperand &O = Operands[I];
+        bool Cheap = !O.MayTrap && O.Cost <= CheapCost;
+        if (Decided && Cheap)
+        {
+          dispatch(O.C);
+          Decided = IsAnd ? Builder.CreateAnd(Decided, V) : Builder.CreateOr(Decided, V);
+          continue;
+        }
+        if (Decided)
+        {
+          BasicBlock *Next = BasicBlock::Create(M->getContext(), IsAnd ? "and.rhs" : "or.rhs", Fn);
+          Builder.CreateCondBr(Decided, IsAnd ? Next : True, IsAnd ? False : Next);
+          Builder.SetInsertPoint(Next);
+          Decided = nullptr;
+        }
+        if (I + 1 == Operands.size())
+        {
+          emitBranch(O.C, True, False);
+          return;
+        }
+        if (Cheap || isa<Condition>(O.C))
+        {
+          dispatch(O.C);
+          Decided = V;
+          continue;
+        }
+        // an expensive nested chain decides with its own branches
+        BasicBlock *Next = BasicBlock::Create(M->getContext(), IsAnd ? "and.rhs" : "or.rhs", Fn);
+        emitBranch(O.C, IsAnd ? Next : True, IsAnd ? False : Next);
+        Builder.SetInsertPoint(Next);
+      }
+      Builder.CreateCondBr(Decided, True, False);
+    }
+  public:
+    using StaticASTVisitor<ToIRVisitor>::visit;
+
+    ToIRVisitor(Module *M, ASTContext &Context, const OutputSet &Outputs)
+        : IRLowering(M, Context, Outputs) {}
+
+    // Entry point for generating LLVM IR from the AST.
+    void run(AST *Tree)
+    {
+      beginMain();
+
+      // Visit the root node of the AST to generate IR.
+      dispatch(Tree);
+
+      endMain();
+    }
+
+    // Visit function for the ARK node in the AST.
+    void visit(ARK &Node)
+    {
+      // Iterate over the children of the MSM node and visit each child.
+      for (llvm::ArrayRef<Statement *>::const_iterator I = Node.begin(), E = Node.end(); I != E; ++I)
+      {
+        dispatch((*I));
+      }
+    };
+
+void visit(Assign &Node)
+    {
+      // Visit the right-hand side of the assignment and get its value.
+      dispatch(Node.getRight());
+      Value *val = V;
+
+      emitAssign(Node.getAssignmentOP(), Node.getLeft()->getSymbol(), val);
+    };
+
+    void visit(Final &Node)
     {
       if (Node.getKind() == Final::Ident)
       {
         // If the factor is an identifier, load its value from memory.
-        V = Builder.CreateLoad(Int32Ty, nameMap[Node.getVal()]);
+        V = Builder.CreateLoad(Int32Ty, nameMap[Node.getSymbol()]);
       }
       else
       {
-        // If the factor is a literal, convert it to an integer and create a constant.
-        int intval;
-        Node.getVal().getAsInteger(10, intval);
-        V = ConstantInt::get(Int32Ty, intval, true);
+        // If the factor is a literal, create a constant from its value.
+        V = ConstantInt::get(Int32Ty, Node.getValue(), true);
       }
     };
 
-    virtual void visit(Expr &Node) override
+    void visit(Expr &Node)
     {
       // Visit the left-hand side of the binary operation and get its value.
-      Node.getLeft()->accept(*this);
+      dispatch(Node.getLeft());
       Value *Left = V;
 
       // Visit the right-hand side of the binary operation and get its value.
       Value *Right;
       if(Node.getRight()) {
-        Node.getRight()->accept(*this);
+        dispatch(Node.getRight());
         Right = V;
 
-        // Perform the binary operation based on the operator type and create the corresponding instruction.
-        switch (Node.getOperator())
-        {
-          case Expr::Plus:
-          {
-            V = Builder.CreateNSWAdd(Left, Right);
-            break;
-          }
-          case Expr::Minus:
-          {
-            V = Builder.CreateNSWSub(Left, Right);
-            break;
-          }
-          case Expr::Mul:
-          {
-            V = Builder.CreateNSWMul(Left, Right);
-            break;
-          }
-          case Expr::Div:
-          {
-            V = Builder.CreateSDiv(Left, Right);
-            break;
-          }
-          case Expr::Pow:
-          {
-            Final *right_final = (Final *) Node.getRight();
-            int intval = 0;
-            right_final->getVal().getAsInteger(10, intval);
-            if (intval == 0)
-            {
-              V = ConstantInt::get(Int32Ty, 1, true);
-            }
-            else
-            {
-              
-              Value* TempLeft = Left;
-              for (int i = 1; i < intval; i++)
-              {
-                Left = Builder.CreateNSWMul(Left, TempLeft);
-              }
-              V = Left;
-            }
-            break;
-          }
-          case Expr::Mod:
-          {
-            // x % y = x - (x / y) * y
-            Value *division = Builder.CreateSDiv(Left, Right);
-            Value *multiply = Builder.CreateNSWMul(division, Right);
-            V = Builder.CreateNSWSub(Left, multiply);
-            break;
-          }
-        }
-      }  
+        V = emitBinary(Node.getOperator(), Left, Right, Node.hasNoSignedWrap());
+      }
     };
 
-    virtual void visit(Declare &Node) override
+    void visit(Declare &Node)
     {
       Value *val = nullptr;
 
-      llvm::SmallVector<Expr *>::const_iterator L = Node.ExprsBegin();
-      llvm::SmallVector<Expr *>::const_iterator R = Node.ExprsEnd();
-      for (llvm::SmallVector<llvm::StringRef, 8>::const_iterator I = Node.VarsBegin(), E = Node.VarsEnd(); I != E; ++I)
+      llvm::ArrayRef<Expr *>::const_iterator L = Node.ExprsBegin();
+      llvm::ArrayRef<Expr *>::const_iterator R = Node.ExprsEnd();
+      for (llvm::ArrayRef<unsigned>::const_iterator I = Node.getSymbols().begin(), E = Node.getSymbols().end(); I != E; ++I)
       {
-        StringRef Var = *I;
-        nameMap[Var] = Builder.CreateAlloca(Int32Ty);
+        AllocaInst *varSlot = nameMap[*I] = Builder.CreateAlloca(Int32Ty);
 
         if (L != R)
         {
-          (*L)->accept(*this);
+          dispatch((*L));
           val = V;
           if (val != nullptr)
           {
-            Builder.CreateStore(val, nameMap[Var]);
+            Builder.CreateStore(val, varSlot);
           }
 
           ++L;
         }
         else
         {
-          Builder.CreateStore(Int32Zero, nameMap[Var]);
+          Builder.CreateStore(Int32Zero, varSlot);
         }
       }
     };
 
-    virtual void visit(Condition &Node) override
+    void visit(If &Node)
     {
+      Function *Fn = Builder.GetInsertBlock()->getParent();
+      BasicBlock *End = BasicBlock::Create(M->getContext(), "if.end");
+
+      // Each arm tests its condition and falls through to the next arm.
+      auto EmitArm = [&](Conditions *Conds, ArrayRef<Assign *> Assignments, bool HasNext) {
+        BasicBlock *Then = BasicBlock::Create(M->getContext(), "if.then");
+        BasicBlock *Next = HasNext ? BasicBlock::Create(M->getContext(), "if.else") : End;
+        emitBranch(Conds, Then, Next);
+        Then->insertInto(Fn);
+        Builder.SetInsertPoint(Then);
+        for (Assign *A : Assignments)
+          dispatch(A);
+        Builder.CreateBr(End);
+        if (HasNext)
+        {
+          Next->insertInto(Fn);
+          Builder.SetInsertPoint(Next);
+        }
+      };
 
-      Node.getLeft()->accept(*this);
+      ArrayRef<Elif *> Elifs = Node.getElifs();
+      EmitArm(Node.getConds(), Node.getAssignments(), !Elifs.empty() || Node.getElse());
+      for (size_t I = 0; I < Elifs.size(); ++I)
+        EmitArm(Elifs[I]->getConds(), Elifs[I]->getAssignments(), I + 1 < Elifs.size() || Node.getElse());
+      if (Else *ElseBranch = Node.getElse())
+      {
+        for (Assign *A : ElseBranch->getAssignments())
+          dispatch(A);
+        Builder.CreateBr(End);
+      }
+
+      End->insertInto(Fn);
+      Builder.SetInsertPoint(End);
+    };
+
+    void visit(Loop &Node)
+    {
+      Function *Fn = Builder.GetInsertBlock()->getParent();
+      BasicBlock *Cond = BasicBlock::Create(M->getContext(), "loop.cond", Fn);
+      BasicBlock *Body = BasicBlock::Create(M->getContext(), "loop.body");
+      BasicBlock *End = BasicBlock::Create(M->getContext(), "loop.end");
+
+      Builder.CreateBr(Cond);
+      Builder.SetInsertPoint(Cond);
+      emitBranch(Node.getConds(), Body, End);
+
+      Body->insertInto(Fn);
+      Builder.SetInsertPoint(Body);
+      for (Assign *A : Node.getAssignments())
+        dispatch(A);
+      Builder.CreateBr(Cond);
+
+      End->insertInto(Fn);
+      Builder.SetInsertPoint(End);
+    };
+
+    void visit(Condition &Node)
+    {
+
+      dispatch(Node.getLeft());
       Value *Left = V;
 
       // Visit the right-hand side of the binary operation and get its value.
-      Node.getRight()->accept(*this);
+      dispatch(Node.getRight());
       Value *Right = V;
       
-      // Perform the binary operation based on the operator type and create the corresponding instruction.
-      switch (Node.getSign())
-      {
-        case Condition::LessEqual:
-        {
-          V = Builder.CreateICmpSLE(Left, Right);
-          break;
-        }
-        case Condition::LessThan:
-        {
-          V = Builder.CreateICmpSLT(Left, Right);
-          break;
-        }
-        case Condition::GreaterThan:
-        {
-          V = Builder.CreateICmpSGT(Left, Right);
-          break;
-        }
-        case Condition::GreaterEqual:
-        {
-          V = Builder.CreateICmpSGE(Left, Right);
-          break;
-        }
-        case Condition::EqualEqual:
-        {
-          V = Builder.CreateICmpEQ(Left, Right);
-          break;
-        }
-        case Condition::NotEqual:
-        {
-          V = Builder.CreateICmpNE(Left, Right);
-          break;
-        }
-      }
+      V = emitCompare(Node.getSign(), Left, Right);
     };
 
-    virtual void visit(Conditions &Node) override
+    // The value of a chain evaluated without branches; emitBranch only
+    // lets chains that are cheap and cannot trap get here.
+    void visit(Conditions &Node)
     {
-      Node.getLeft()->accept(*this);
+      dispatch(Node.getLeft());
       Value* Left = V;
       
       if (!Node.getRight())
@@ -335,7 +730,7 @@ virtual void visit(Assign &Node) override
         return;
       }
       
-      Node.getRight()->accept(*this);
+      dispatch(Node.getRight());
       Value* Right = V;
 
       switch (Node.getSign())
@@ -349,20 +744,280 @@ virtual void visit(Assign &Node) override
       }
     };
   };
+
+  // Generates IR from a FlatAST in one scan over its nodes, after a scan
+  // that marks where the conditions of elif arms and loops and the right
+  // operands of and/or start. The operators, assignments and writes are
+  // lowered as by ToIRVisitor. Every and/or branches on its left operand:
+  // ordering the operands of a chain by cost needs the whole chain at hand,
+  // which one scan in node order does not have.
+  class FlatToIR : IRLowering
+  {
+    const FlatAST &Tree;
+
+    // what starts at a node, see markStarts
+    enum StartKind : uint8_t
+    {
+      NoStart,
+      AndRight,  // the right operand of an and
+      OrRight,   // the right operand of an or
+      ArmConds,  // the condition of an elif arm
+      LoopConds  // the condition of a loop
+    };
+    std::vector<uint8_t> Starts;
+
+    // values of the nodes not yet used as an operand
+    SmallVector<Value *, 16> Values;
+
+    // an and/or whose right operand is being emitted
+    struct PendingLogical
+    {
+      BasicBlock *Left; // where the left operand decided the result
+      BasicBlock *End;
+      bool IsAnd;
+    };
+    SmallVector<PendingLogical, 8> Logicals;
+
+    // the if statement being emitted; bodies only hold assignments, so
+    // there is at most one, and at most one loop
+    uint32_t IfEnd = FlatAST::None;
+    BasicBlock *IfJoin = nullptr;
+    BasicBlock *NextArm = nullptr; // null once the else arm has started
+    uint32_t LoopEnd = FlatAST::None;
+    BasicBlock *LoopCond = nullptr;
+    BasicBlock *LoopExit = nullptr;
+
+    Value *pop() { return Values.pop_back_val(); }
+
+    void enter(BasicBlock *BB)
+    {
+      BB->insertInto(MainFn);
+      Builder.SetInsertPoint(BB);
+    }
+
+    // Marks the first node of each operand that must not run in the block
+    // before it. Operands end right before their user, so a stack of where
+    // the pending operands start is enough to find their first node.
+    void markStarts()
+    {
+      Starts.assign(Tree.size(), NoStart);
+      SmallVector<uint32_t, 16> Begins;
+      for (uint32_t I = 0, E = Tree.size(); I != E; ++I)
+      {
+        switch (Tree.Kinds[I])
+        {
+        case FlatAST::Number:
+        case FlatAST::Ident:
+          Begins.push_back(I);
+          break;
+        case FlatAST::Logical:
+          Starts[Begins.back()] = Tree.Ops[I] == Conditions::And ? AndRight : OrRight;
+          LLVM_FALLTHROUGH;
+        case FlatAST::Binary:
+        case FlatAST::Compare:
+          Begins.pop_back();
+          break;
+        case FlatAST::ElifBranch:
+          Starts[Begins.pop_back_val()] = ArmConds;
+          break;
+        case FlatAST::LoopBody:
+          Starts[Begins.pop_back_val()] = LoopConds;
+          break;
+        case FlatAST::IfBranch:
+        case FlatAST::Init:
+        case FlatAST::Store:
+          Begins.pop_back();
+          break;
+        case FlatAST::DeclVar:
+        case FlatAST::ElseBranch:
+          break;
+        }
+      }
+    }
+
+    // Ends the arm being emitted and continues with the test of the next.
+    void endArm()
+    {
+      Builder.CreateBr(IfJoin);
+      enter(NextArm);
+    }
+
+    void beginArm(Value *Cond)
+    {
+      BasicBlock *Then = BasicBlock::Create(M->getContext(), "if.then");
+      NextArm = BasicBlock::Create(M->getContext(), "if.else");
+      Builder.CreateCondBr(Cond, Then, NextArm);
+      enter(Then);
+    }
+
+    void endIf()
+    {
+      Builder.CreateBr(IfJoin);
+      if (NextArm)
+      {
+        enter(NextArm);
+        Builder.CreateBr(IfJoin);
+      }
+      enter(IfJoin);
+      IfEnd = FlatAST::None;
+    }
+
+    void endLoop()
+    {
+      Builder.CreateBr(LoopCond);
+      enter(LoopExit);
+      LoopEnd = FlatAST::None;
+    }
+
+    void emitStart(uint32_t I)
+    {
+      switch (Starts[I])
+      {
+      case AndRight:
+      case OrRight:
+      {
+        bool IsAnd = Starts[I] == AndRight;
+        BasicBlock *Right = BasicBlock::Create(M->getContext(), IsAnd ? "and.rhs" : "or.rhs");
+        BasicBlock *End = BasicBlock::Create(M->getContext(), IsAnd ? "and.end" : "or.end");
+        Builder.CreateCondBr(Values.back(), IsAnd ? Right : End, IsAnd ? End : Right);
+        Logicals.push_back({Builder.GetInsertBlock(), End, IsAnd});
+        enter(Right);
+        break;
+      }
+      case ArmConds:
+        endArm();
+        break;
+      case LoopConds:
+        LoopCond = BasicBlock::Create(M->getContext(), "loop.cond");
+        Builder.CreateBr(LoopCond);
+        enter(LoopCond);
+        break;
+      }
+    }
+
+    void emitNode(uint32_t I)
+    {
+      uint32_t Left = Tree.LHS[I];
+      switch (Tree.Kinds[I])
+      {
+      case FlatAST::Number:
+        Values.push_back(ConstantInt::get(Int32Ty, (int32_t)Left, true));
+        break;
+      case FlatAST::Ident:
+        Values.push_back(Builder.CreateLoad(Int32Ty, nameMap[Left]));
+        break;
+      case FlatAST::Binary:
+      {
+        Value *R = pop();
+        Value *L = pop();
+        Values.push_back(emitBinary((Expr::Operator)Tree.Ops[I], L, R, true));
+        break;
+      }
+      case FlatAST::Compare:
+      {
+        Value *R = pop();
+        Value *L = pop();
+        Values.push_back(emitCompare((Condition::Operator)Tree.Ops[I], L, R));
+        break;
+      }
+      case FlatAST::Logical:
+      {
+        // the left operand decided the result unless the right one ran
+        Value *R = pop();
+        pop();
+        PendingLogical P = Logicals.pop_back_val();
+        BasicBlock *RightEnd = Builder.GetInsertBlock();
+        Builder.CreateBr(P.End);
+        enter(P.End);
+        PHINode *Phi = Builder.CreatePHI(Builder.getInt1Ty(), 2);
+        Phi->addIncoming(Builder.getInt1(!P.IsAnd), P.Left);
+        Phi->addIncoming(R, RightEnd);
+        Values.push_back(Phi);
+        break;
+      }
+      case FlatAST::DeclVar:
+        nameMap[Left] = Builder.CreateAlloca(Int32Ty);
+        Builder.CreateStore(Int32Zero, nameMap[Left]);
+        break;
+      case FlatAST::Init:
+        Builder.CreateStore(pop(), nameMap[Left]);
+        break;
+      case FlatAST::Store:
+        emitAssign((Assign::AssOp)Tree.Ops[I], Left, pop());
+        break;
+      case FlatAST::IfBranch:
+        IfJoin = BasicBlock::Create(M->getContext(), "if.end");
+        IfEnd = Tree.RHS[I];
+        beginArm(pop());
+        break;
+      case FlatAST::ElifBranch:
+        beginArm(pop());
+        break;
+      case FlatAST::ElseBranch:
+        endArm();
+        NextArm = nullptr;
+        break;
+      case FlatAST::LoopBody:
+      {
+        BasicBlock *Body = BasicBlock::Create(M->getContext(), "loop.body");
+        LoopExit = BasicBlock::Create(M->getContext(), "loop.end");
+        LoopEnd = Tree.RHS[I];
+        Builder.CreateCondBr(pop(), Body, LoopExit);
+        enter(Body);
+        break;
+      }
+      }
+    }
+
+  public:
+    FlatToIR(Module *M, const FlatAST &Tree, ASTContext &Context, const OutputSet &Outputs)
+        : IRLowering(M, Context, Outputs), Tree(Tree) {}
+
+    void run()
+    {
+      markStarts();
+      beginMain();
+      for (uint32_t I = 0, E = Tree.size(); I <= E; ++I)
+      {
+        if (I == IfEnd)
+          endIf();
+        if (I == LoopEnd)
+          endLoop();
+        if (I == E)
+          break;
+        if (Starts[I] != NoStart)
+          emitStart(I);
+        emitNode(I);
+      }
+      endMain();
+    }
+  };
 }; // namespace
 
-void CodeGen::compile(AST *Tree)
+void CodeGen::compile(AST *Tree, ASTContext &Context, const OutputSet &Outputs)
 {
-  // Create an LLVM context and a module.
+  // Create an LLVM context and a module. Both live on the stack, so the module
+  // and everything in it are freed before the context they belong to.
   LLVMContext Ctx;
-  Module *M = new Module("ark", Ctx);
+  Module M("ark", Ctx);
 
   // Create an instance of the ToIRVisitor and run it on the AST to generate LLVM IR.
-  // ToIRVisitor ToIR(M);
-  ns::ToIRVisitor *ToIR = new ns::ToIRVisitor(M);
-  
-  ToIR->run(Tree);
+  ns::ToIRVisitor ToIR(&M, Context, Outputs);
+
+  ToIR.run(Tree);
 
   // Print the generated module to the standard output.
-  M->print(outs(), nullptr);
-}
\ No newline at end of file
+  M.print(outs(), nullptr);
+}
+
+
+void CodeGen::compile(const FlatAST &Tree, ASTContext &Context, const OutputSet &Outputs)
+{
+  LLVMContext Ctx;
+  Module M("ark", Ctx);
+
+  ns::FlatToIR ToIR(&M, Tree, Context, Outputs);
+  ToIR.run();
+
+  M.print(outs(), nullptr);
+}
@@ -2,11 +2,14 @@
 #define CODEGEN_H
 
 #include "AST.h"
+#include "FlatAST.h"
+#include "OutputSet.h"
 
 class CodeGen
 {
 public:
- void compile(AST *Tree);
+ void compile(AST *Tree, ASTContext &Context, const OutputSet &Outputs);
+ void compile(const FlatAST &Tree, ASTContext &Context, const OutputSet &Outputs);
 
 };
-#endif
\ No newline at end of file
+#endif
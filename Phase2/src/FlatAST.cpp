@@ -0,0 +1,127 @@
+#include "FlatAST.h"
+
+namespace {
+
+// Appends every node of the pointer tree to a FlatAST; the index of the last
+// node emitted for a subtree is left in Last.
+class Flattener : public StaticASTVisitor<Flattener> {
+  FlatAST &Flat;
+  uint32_t Last = FlatAST::None;
+
+  uint32_t emit(AST *Node) {
+    dispatch(Node);
+    return Last;
+  }
+
+  void emitBody(llvm::ArrayRef<Assign *> Assignments) {
+    for (Assign *A : Assignments)
+      dispatch(A);
+  }
+
+public:
+  using StaticASTVisitor<Flattener>::visit;
+
+  Flattener(FlatAST &Flat) : Flat(Flat) {}
+
+  void visit(ARK &Node) {
+    for (Statement *S : Node.getStatements())
+      dispatch(S);
+  };
+
+  void visit(Declare &Node) {
+    llvm::ArrayRef<unsigned> Symbols = Node.getSymbols();
+    llvm::ArrayRef<Expr *> Exprs = Node.getExprs();
+    for (unsigned Symbol : Symbols)
+      Flat.addNode(FlatAST::DeclVar, 0, Symbol, FlatAST::None);
+    for (size_t I = 0, E = Exprs.size(); I != E; ++I) {
+      uint32_t Value = emit(Exprs[I]);
+      Flat.addNode(FlatAST::Init, 0, Symbols[I], Value);
+    }
+  };
+
+  void visit(Assign &Node) {
+    uint32_t Value = emit(Node.getRight());
+    Last = Flat.addNode(FlatAST::Store, Node.getAssignmentOP(),
+                        Node.getLeft()->getSymbol(), Value);
+  };
+
+  void visit(Expr &Node) {
+    uint32_t Left = emit(Node.getLeft());
+    if (!Node.getRight()) {
+      Last = Left;
+      return;
+    }
+    uint32_t Right = emit(Node.getRight());
+    Last = Flat.addNode(FlatAST::Binary, Node.getOperator(), Left, Right);
+  };
+
+  void visit(Final &Node) {
+    if (Node.getKind() == Final::Ident)
+      Last = Flat.addNode(FlatAST::Ident, 0, Node.getSymbol(), FlatAST::None);
+    else
+      Last = Flat.addNode(FlatAST::Number, 0, Node.getValue(), FlatAST::None);
+  };
+
+  void visit(Conditions &Node) {
+    // the and/or chain leans right; emit its conditions in order and then
+    // join them from the last one, as the recursive walk would
+    llvm::SmallVector<Conditions *, 8> Chain;
+    llvm::SmallVector<uint32_t, 8> Operands;
+    Conditions *C = &Node;
+    for (; C && !llvm::isa<Condition>(C); C = C->getRight()) {
+      Chain.push_back(C);
+      Operands.push_back(emit(C->getLeft()));
+    }
+    Last = C ? emit(C) : Operands.pop_back_val();
+    if (!C)
+      Chain.pop_back();
+    while (!Chain.empty())
+      Last = Flat.addNode(FlatAST::Logical, Chain.pop_back_val()->getSign(),
+                          Operands.pop_back_val(), Last);
+  };
+
+  void visit(Condition &Node) {
+    uint32_t Left = emit(Node.getLeft());
+    uint32_t Right = emit(Node.getRight());
+    Last = Flat.addNode(FlatAST::Compare, Node.getSign(), Left, Right);
+  };
+
+  void visit(If &Node) {
+    uint32_t Cond = emit(Node.getConds());
+    uint32_t Branch = Flat.addNode(FlatAST::IfBranch, 0, Cond, FlatAST::None);
+    emitBody(Node.getAssignments());
+    for (Elif *E : Node.getElifs())
+      dispatch(E);
+    if (Node.getElse())
+      dispatch(Node.getElse());
+    Flat.RHS[Branch] = Flat.size();
+  };
+
+  void visit(Elif &Node) {
+    uint32_t Cond = emit(Node.getConds());
+    uint32_t Branch = Flat.addNode(FlatAST::ElifBranch, 0, Cond, FlatAST::None);
+    emitBody(Node.getAssignments());
+    Flat.RHS[Branch] = Flat.size();
+  };
+
+  void visit(Else &Node) {
+    uint32_t Branch = Flat.addNode(FlatAST::ElseBranch, 0, FlatAST::None, FlatAST::None);
+    emitBody(Node.getAssignments());
+    Flat.RHS[Branch] = Flat.size();
+  };
+
+  void visit(Loop &Node) {
+    uint32_t Cond = emit(Node.getConds());
+    uint32_t Body = Flat.addNode(FlatAST::LoopBody, 0, Cond, FlatAST::None);
+    emitBody(Node.getAssignments());
+    Flat.RHS[Body] = Flat.size();
+  };
+};
+}
+
+FlatAST FlatAST::fromTree(AST *Tree) {
+  FlatAST Flat;
+  Flattener F(Flat);
+  F.dispatch(Tree);
+  return Flat;
+}
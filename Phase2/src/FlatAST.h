@@ -0,0 +1,64 @@
+#ifndef FLATAST_H
+#define FLATAST_H
+
+#include "AST.h"
+#include <vector>
+
+// Compact structure-of-arrays form of a program. Node I is described by
+// Kinds[I], Ops[I], LHS[I] and RHS[I] instead of a heap object with a vtable.
+// Operands are 32-bit indices of earlier nodes: expressions are stored in
+// post-order and statements in program order, so analyses that only need a
+// node's operands before the node itself run as one linear scan.
+//
+// With -flat-ast, FlatParser builds this form directly and Sema, the
+// Optimizer and CodeGen each have a flat pass over it. fromTree converts a
+// pointer tree, for the tests that compare the two parsers.
+class FlatAST
+{
+public:
+    enum NodeKind : uint8_t
+    {
+        Number,     // LHS: value of the literal
+        Ident,      // LHS: symbol ID
+        Binary,     // Ops: Expr::Operator, LHS/RHS: operands
+        Compare,    // Ops: Condition::Operator, LHS/RHS: operands
+        Logical,    // Ops: Conditions::Operator, LHS/RHS: operands
+        DeclVar,    // LHS: symbol ID of the declared name
+        Init,       // LHS: symbol ID, RHS: initializer
+        Store,      // Ops: Assign::AssOp, LHS: symbol ID, RHS: value
+        IfBranch,   // LHS: condition, RHS: index one past the whole if statement
+        ElifBranch, // LHS: condition, RHS: index one past the branch
+        ElseBranch, // RHS: index one past the branch
+        LoopBody    // LHS: condition, RHS: index one past the loop
+    };
+
+    static constexpr uint32_t None = ~0u;
+
+    std::vector<NodeKind> Kinds;
+    std::vector<uint8_t> Ops;
+    std::vector<uint32_t> LHS;
+    std::vector<uint32_t> RHS;
+
+    uint32_t size() const { return Kinds.size(); }
+
+    uint32_t addNode(NodeKind Kind, uint8_t Op, uint32_t Left, uint32_t Right)
+    {
+        Kinds.push_back(Kind);
+        Ops.push_back(Op);
+        LHS.push_back(Left);
+        RHS.push_back(Right);
+        return Kinds.size() - 1;
+    }
+
+    // bytes used by the node arrays
+    size_t getMemory() const
+    {
+        return Kinds.capacity() * sizeof(NodeKind) + Ops.capacity() * sizeof(uint8_t) +
+               (LHS.capacity() + RHS.capacity()) * sizeof(uint32_t);
+    }
+
+    // converts a pointer tree built by Parser
+    static FlatAST fromTree(AST *Tree);
+};
+
+#endif
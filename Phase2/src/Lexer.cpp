@@ -1,32 +1,289 @@
 #include "Lexer.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define ARK_LEXER_X86 1
+#include <immintrin.h>
+#endif
+
 // classifying characters
 namespace charinfo
 {
-    // ignore whitespaces
-    LLVM_READNONE inline bool isWhitespace(char c)
+    enum CharClass : unsigned char
+    {
+        Other = 0,
+        Whitespace = 1 << 0,
+        Digit = 1 << 1,
+        Letter = 1 << 2
+    };
+
+    struct ClassTable
+    {
+        unsigned char Class[256];
+    };
+
+    constexpr ClassTable buildClassTable()
     {
-        return c == ' ' || c == '\t' || c == '\f' || c == '\v' ||
-               c == '\r' || c == '\n';
+        ClassTable T{};
+        // ignore whitespaces
+        for (unsigned char c : {' ', '\t', '\f', '\v', '\r', '\n'})
+            T.Class[c] = Whitespace;
+        for (unsigned c = '0'; c <= '9'; ++c)
+            T.Class[c] = Digit;
+        for (unsigned c = 'a'; c <= 'z'; ++c)
+            T.Class[c] = Letter;
+        for (unsigned c = 'A'; c <= 'Z'; ++c)
+            T.Class[c] = Letter;
+        return T;
     }
 
-    LLVM_READNONE inline bool isDigit(char c)
+    constexpr ClassTable Classes = buildClassTable();
+
+    LLVM_READNONE inline bool is(char c, unsigned char Mask)
     {
-        return c >= '0' && c <= '9';
+        return Classes.Class[static_cast<unsigned char>(c)] & Mask;
     }
 
-    LLVM_READNONE inline bool isLetter(char c)
+    LLVM_READNONE inline bool isDigit(char c) { return is(c, Digit); }
+
+    LLVM_READNONE inline bool isLetter(char c) { return is(c, Letter); }
+}
+
+// scanning kernels that find the end of a run of whitespace, identifier
+// characters or digits; each returns the first character outside the run
+namespace scan
+{
+    using ScanFn = const char *(*)(const char *Ptr, const char *End);
+
+    template <unsigned char Mask>
+    const char *scalar(const char *Ptr, const char *End)
     {
-        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+        while (Ptr != End && charinfo::is(*Ptr, Mask))
+            ++Ptr;
+        return Ptr;
+    }
+
+#ifdef ARK_LEXER_X86
+    // 16 bytes per step, SSE2 is always available on x86-64
+    namespace sse2
+    {
+        // bytes in [Lo, Hi] become 0xff: an unsigned compare built from min
+        inline __m128i inRange(__m128i V, char Lo, char Hi)
+        {
+            __m128i T = _mm_sub_epi8(V, _mm_set1_epi8(Lo));
+            return _mm_cmpeq_epi8(_mm_min_epu8(T, _mm_set1_epi8(Hi - Lo)), T);
+        }
+
+        inline __m128i classify(__m128i V, unsigned char Mask)
+        {
+            __m128i M = _mm_setzero_si128();
+            if (Mask & charinfo::Whitespace)
+                M = _mm_or_si128(M, _mm_or_si128(inRange(V, '\t', '\r'),
+                                                 _mm_cmpeq_epi8(V, _mm_set1_epi8(' '))));
+            if (Mask & charinfo::Digit)
+                M = _mm_or_si128(M, inRange(V, '0', '9'));
+            if (Mask & charinfo::Letter)
+                M = _mm_or_si128(M, inRange(_mm_or_si128(V, _mm_set1_epi8(0x20)), 'a', 'z'));
+            return M;
+        }
+
+        template <unsigned char Mask>
+        const char *run(const char *Ptr, const char *End)
+        {
+            while (End - Ptr >= 16)
+            {
+                __m128i V = _mm_loadu_si128(reinterpret_cast<const __m128i *>(Ptr));
+                unsigned Outside = ~_mm_movemask_epi8(classify(V, Mask)) & 0xffffu;
+                if (Outside)
+                    return Ptr + __builtin_ctz(Outside);
+                Ptr += 16;
+            }
+            return scalar<Mask>(Ptr, End);
+        }
+    }
+
+    // 32 bytes per step, only used when the CPU reports AVX2
+    namespace avx2
+    {
+        __attribute__((target("avx2"))) inline __m256i inRange(__m256i V, char Lo, char Hi)
+        {
+            __m256i T = _mm256_sub_epi8(V, _mm256_set1_epi8(Lo));
+            return _mm256_cmpeq_epi8(_mm256_min_epu8(T, _mm256_set1_epi8(Hi - Lo)), T);
+        }
+
+        __attribute__((target("avx2"))) inline __m256i classify(__m256i V, unsigned char Mask)
+        {
+            __m256i M = _mm256_setzero_si256();
+            if (Mask & charinfo::Whitespace)
+                M = _mm256_or_si256(M, _mm256_or_si256(inRange(V, '\t', '\r'),
+                                                       _mm256_cmpeq_epi8(V, _mm256_set1_epi8(' '))));
+            if (Mask & charinfo::Digit)
+                M = _mm256_or_si256(M, inRange(V, '0', '9'));
+            if (Mask & charinfo::Letter)
+                M = _mm256_or_si256(M, inRange(_mm256_or_si256(V, _mm256_set1_epi8(0x20)), 'a', 'z'));
+            return M;
+        }
+
+        template <unsigned char Mask>
+        __attribute__((target("avx2"))) const char *run(const char *Ptr, const char *End)
+        {
+            while (End - Ptr >= 32)
+            {
+                __m256i V = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(Ptr));
+                unsigned Outside = ~static_cast<unsigned>(_mm256_movemask_epi8(classify(V, Mask)));
+                if (Outside)
+                    return Ptr + __builtin_ctz(Outside);
+                Ptr += 32;
+            }
+            return sse2::run<Mask>(Ptr, End);
+        }
+    }
+#endif
+
+    struct Kernels
+    {
+        ScanFn Whitespace;
+        ScanFn Identifier;
+        ScanFn Digits;
+    };
+
+    // pick the widest kernel the running CPU supports
+    Kernels select()
+    {
+#ifdef ARK_LEXER_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            return {avx2::run<charinfo::Whitespace>,
+                    avx2::run<charinfo::Letter | charinfo::Digit>,
+                    avx2::run<charinfo::Digit>};
+        return {sse2::run<charinfo::Whitespace>,
+                sse2::run<charinfo::Letter | charinfo::Digit>,
+                sse2::run<charinfo::Digit>};
+#else
+        return {scalar<charinfo::Whitespace>,
+                scalar<charinfo::Letter | charinfo::Digit>,
+                scalar<charinfo::Digit>};
+#endif
+    }
+
+    const Kernels Selected = select();
+
+    // most runs are a few characters long, so look at those one at a time
+    // and only hand long runs to the vector kernel; the null terminator at
+    // End is in no class, so the short loop cannot run past it
+    template <unsigned char Mask>
+    inline const char *run(const char *Ptr, const char *End, ScanFn Wide)
+    {
+        for (unsigned I = 0; I < 4; ++I)
+            if (!charinfo::is(Ptr[I], Mask))
+                return Ptr + I;
+        return Wide(Ptr + 4, End);
     }
 }
 
-void Lexer::next(Token &token)
+// operator transitions: the kind of a one character operator and, for the
+// characters that can be followed by '=', the kind of the two character form
+namespace opinfo
 {
-    while (*BufferPtr && charinfo::isWhitespace(*BufferPtr))
+    struct OperatorTable
     {
-        ++BufferPtr;
+        Token::TokenKind Single[256];
+        Token::TokenKind WithEqual[256];
+    };
+
+    constexpr OperatorTable buildOperatorTable()
+    {
+        OperatorTable T{};
+        for (unsigned c = 0; c < 256; ++c)
+        {
+            T.Single[c] = Token::unknown;
+            T.WithEqual[c] = Token::unknown;
+        }
+        T.Single['>'] = Token::gr;        T.WithEqual['>'] = Token::ge;
+        T.Single['<'] = Token::ls;        T.WithEqual['<'] = Token::le;
+        T.Single['='] = Token::equal;     T.WithEqual['='] = Token::equal_equal;
+                                          T.WithEqual['!'] = Token::nq;
+        T.Single['+'] = Token::plus;      T.WithEqual['+'] = Token::plus_equal;
+        T.Single['-'] = Token::minus;     T.WithEqual['-'] = Token::minus_equal;
+        T.Single['*'] = Token::star;      T.WithEqual['*'] = Token::star_equal;
+        T.Single['/'] = Token::slash;     T.WithEqual['/'] = Token::slash_equal;
+        T.Single['%'] = Token::mod;       T.WithEqual['%'] = Token::mod_equal;
+        T.Single['('] = Token::l_paren;
+        T.Single[')'] = Token::r_paren;
+        T.Single[':'] = Token::colon;
+        T.Single[';'] = Token::semicolon;
+        T.Single[','] = Token::comma;
+        T.Single['^'] = Token::hat;
+        return T;
     }
+
+    constexpr OperatorTable Operators = buildOperatorTable();
+}
+
+// perfect hash of the keywords on their length plus first and last characters
+namespace keywords
+{
+    struct Keyword
+    {
+        const char *Name;
+        unsigned Len;
+        Token::TokenKind Kind;
+    };
+
+    constexpr Keyword List[] = {
+        {"int", 3, Token::KW_int},     {"if", 2, Token::KW_if},
+        {"else", 4, Token::KW_else},   {"elif", 4, Token::KW_elif},
+        {"begin", 5, Token::KW_begin}, {"end", 3, Token::KW_end},
+        {"loopc", 5, Token::KW_loopc}, {"and", 3, Token::KW_and},
+        {"or", 2, Token::KW_or},
+    };
+
+    constexpr unsigned MinLen = 2;
+    constexpr unsigned MaxLen = 5;
+    constexpr unsigned TableSize = 16;
+
+    constexpr unsigned hash(unsigned Len, char First, char Last)
+    {
+        return (Len + static_cast<unsigned char>(First) + static_cast<unsigned char>(Last)) & (TableSize - 1);
+    }
+
+    struct KeywordTable
+    {
+        Keyword Slots[TableSize];
+        bool Collision;
+    };
+
+    constexpr KeywordTable buildKeywordTable()
+    {
+        KeywordTable T{};
+        for (unsigned I = 0; I < TableSize; ++I)
+            T.Slots[I] = {"", 0, Token::ident};
+        for (const Keyword &K : List)
+        {
+            Keyword &Slot = T.Slots[hash(K.Len, K.Name[0], K.Name[K.Len - 1])];
+            if (Slot.Len != 0)
+                T.Collision = true;
+            Slot = K;
+        }
+        return T;
+    }
+
+    constexpr KeywordTable Table = buildKeywordTable();
+    static_assert(!Table.Collision, "keyword hash is not perfect, adjust hash()");
+
+    inline Token::TokenKind lookup(llvm::StringRef Name)
+    {
+        if (Name.size() < MinLen || Name.size() > MaxLen)
+            return Token::ident;
+        const Keyword &K = Table.Slots[hash(Name.size(), Name.front(), Name.back())];
+        if (K.Len == Name.size() && Name == llvm::StringRef(K.Name, K.Len))
+            return K.Kind;
+        return Token::ident;
+    }
+}
+
+void Lexer::next(Token &token)
+{
+    BufferPtr = scan::run<charinfo::Whitespace>(BufferPtr, BufferEnd, scan::Selected.Whitespace);
     // make sure we didn't reach the end of input
     if (!*BufferPtr)
     {
@@ -36,164 +293,27 @@ void Lexer::next(Token &token)
     // collect characters and check for keywords or ident
     if (charinfo::isLetter(*BufferPtr))
     {
-        const char *end = BufferPtr + 1;
-        while (charinfo::isLetter(*end) || charinfo::isDigit(*end))
-            ++end;
+        const char *end = scan::run<charinfo::Letter | charinfo::Digit>(BufferPtr + 1, BufferEnd, scan::Selected.Identifier);
         llvm::StringRef Name(BufferPtr, end - BufferPtr);
-        Token::TokenKind kind;
-        if (Name == "int")
-            kind = Token::KW_int;
-        else if (Name == "if")
-            kind = Token::KW_if;
-        else if (Name == "else")
-            kind = Token::KW_else;
-        else if (Name == "elif")
-            kind = Token::KW_elif;
-        else if (Name == "begin")
-            kind = Token::KW_begin;
-        else if (Name == "end")
-            kind = Token::KW_end;
-        else if (Name == "loopc")
-            kind = Token::KW_loopc;
-        else if (Name == "and")
-            kind = Token::KW_and;
-        else if (Name == "or")
-            kind = Token::KW_or;
-        else 
-            kind = Token::ident;
         // generate the token
-        formToken(token, end, kind);
+        formToken(token, end, keywords::lookup(Name));
         return;
     }
     // check for numbers
     else if (charinfo::isDigit(*BufferPtr))
     {
-        const char *end = BufferPtr + 1;
-        while (charinfo::isDigit(*end))
-            ++end;
+        const char *end = scan::run<charinfo::Digit>(BufferPtr + 1, BufferEnd, scan::Selected.Digits);
         formToken(token, end, Token::number);
         return;
     }
     else
     {
-        switch (*BufferPtr)
-        {
-        case '>':
-            if (*(BufferPtr + 1) == '=')
-            {
-                formToken(token, BufferPtr + 2, Token::ge);
-                return;
-            }
-            else
-            {
-                formToken(token, BufferPtr + 1, Token::gr);
-                return;
-            }
-        case '<':
-            if (*(BufferPtr + 1) == '=')
-            {
-                formToken(token, BufferPtr + 2, Token::le);
-                return;
-            }
-            else
-            {
-                formToken(token, BufferPtr + 1, Token::ls);
-                return;
-            }
-        case '=':
-            if (*(BufferPtr + 1) == '=')
-            {
-                formToken(token, BufferPtr + 2, Token::equal_equal); // equal
-                return;
-            }
-            else
-            {
-                formToken(token, BufferPtr + 1, Token::equal);
-                return;
-            }
-        case '!':
-            if (*(BufferPtr + 1) == '=')
-            {
-                formToken(token, BufferPtr + 2, Token::nq);
-                return;
-            }
-        case '+':
-            if (*(BufferPtr + 1) == '=')
-            {
-                formToken(token, BufferPtr + 2, Token::plus_equal);
-                return;
-            }
-            else
-            {
-                formToken(token, BufferPtr + 1, Token::plus);
-                return;
-            }
-        case '-':
-            if (*(BufferPtr + 1) == '=')
-            {
-                formToken(token, BufferPtr + 2, Token::minus_equal);
-                return;
-            }
-            else
-            {
-                formToken(token, BufferPtr + 1, Token::minus);
-                return;
-            }
-        case '*':
-            if (*(BufferPtr + 1) == '=')
-            {
-                formToken(token, BufferPtr + 2, Token::star_equal);
-                return;
-            }
-            else
-            {
-                formToken(token, BufferPtr + 1, Token::star);
-                return;
-            }
-        case '/':
-            if (*(BufferPtr + 1) == '=')
-            {
-                formToken(token, BufferPtr + 2, Token::slash_equal);
-                return;
-            }
-            else
-            {
-                formToken(token, BufferPtr + 1, Token::slash);
-                return;
-            }
-        case '%':
-            if (*(BufferPtr + 1) == '=')
-            {
-                formToken(token, BufferPtr + 2, Token::mod_equal);
-                return;
-            }
-            else
-            {
-                formToken(token, BufferPtr + 1, Token::mod);
-                return;
-            }
-        case '(':
-            formToken(token, BufferPtr + 1, Token::l_paren);
-            return;
-        case ')':
-            formToken(token, BufferPtr + 1, Token::r_paren);
-            return;
-        case ':':
-            formToken(token, BufferPtr + 1, Token::colon);
-            return;
-        case ';':
-            formToken(token, BufferPtr + 1, Token::semicolon);
-            return;
-        case ',':
-            formToken(token, BufferPtr + 1, Token::comma);
-            return;
-        case '^':
-             formToken(token, BufferPtr +1 , Token::hat);
-             return ;
-        default:
-            formToken(token, BufferPtr + 1, Token::unknown);
-            break;
-        }
+        unsigned char c = *BufferPtr;
+        Token::TokenKind Kind = opinfo::Operators.WithEqual[c];
+        if (Kind != Token::unknown && *(BufferPtr + 1) == '=')
+            formToken(token, BufferPtr + 2, Kind);
+        else
+            formToken(token, BufferPtr + 1, opinfo::Operators.Single[c]);
     }
 }
 
@@ -203,4 +323,4 @@ void Lexer::formToken(Token &Tok, const char *TokEnd,
     Tok.Kind = Kind;
     Tok.Text = llvm::StringRef(BufferPtr, TokEnd - BufferPtr);
     BufferPtr = TokEnd;
-}
\ No newline at end of file
+}
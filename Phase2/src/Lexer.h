@@ -75,12 +75,16 @@ class Lexer
 {
     const char *BufferStart; // pointer to the beginning of the input
     const char *BufferPtr;   // pointer to the next unprocessed character
+    const char *BufferEnd;   // pointer to the terminating null character
 
 public:
+    // the buffer must be null terminated, as MemoryBuffer guarantees; the
+    // vectorized scanners never read past BufferEnd
     Lexer(const llvm::StringRef &Buffer)
     {
         BufferStart = Buffer.begin();
         BufferPtr = BufferStart;
+        BufferEnd = Buffer.end();
     }
 
     void next(Token &token); // return the next token
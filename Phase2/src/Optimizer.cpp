@@ -1,206 +1,2697 @@
-#include <map>
+#include <numeric>
 #include <vector>
 #include <string>
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/StringRef.h"
-#include "llvm/ADT/StringMap.h"
-#include "llvm/IR/IRBuilder.h"
-#include "llvm/IR/LLVMContext.h"
 #include "llvm/Support/raw_ostream.h"
-#include "llvm/IR/Value.h"
 
 #include "Optimizer.h"
 
 using namespace llvm;
 
-bool debugMode;
+namespace OptimizationMethods{
+
+    // ------------------- Control-flow graph -------------------
+    // One write to a variable: an assignment, or one variable of a
+    // declaration together with its initializer.
+    struct Definition {
+        Statement *Stmt;
+        unsigned Index; // position of the variable in a declaration
+        unsigned Var;
+        unsigned UsesBegin, UsesEnd; // variables read, in CFG::Uses
+        bool Observable; // the write is printed, so it is always live
+        bool Live = false;
+    };
+
+    struct Block {
+        std::vector<Definition> Defs; // in program order
+        // condition evaluated at the end of the block, if CondOf >= 0
+        int CondOf = -1;
+        unsigned CondUsesBegin = 0, CondUsesEnd = 0;
+        int Region = -1; // region whose body this block is
+        SmallVector<unsigned, 2> Succs, Preds;
+        BitVector LiveIn;
+    };
+
+    // An if statement with all of its arms, or a loop. Its conditions are
+    // only needed when some assignment in its bodies is live.
+    struct Region {
+        SmallVector<unsigned, 2> CondBlocks;
+        bool Useful = false;
+    };
+
+    struct CFG {
+        std::vector<Block> Blocks;
+        std::vector<Region> Regions;
+        std::vector<unsigned> Uses;
+        unsigned Exit = 0;
+
+        unsigned addBlock(int Region = -1) {
+            Blocks.emplace_back();
+            Blocks.back().Region = Region;
+            return Blocks.size() - 1;
+        }
+
+        void addEdge(unsigned From, unsigned To) {
+            Blocks[From].Succs.push_back(To);
+            Blocks[To].Preds.push_back(From);
+        }
+    };
+
+    // Replaces operand Operand of User: an initializer of a declaration, the
+    // right-hand side of an assignment or a side of a condition or binary
+    // expression.
+    void setOperand(AST *User, unsigned Operand, Expr *E) {
+        if (Declare *D = dyn_cast<Declare>(User))
+            D->getExprs()[Operand] = E;
+        else if (Assign *A = dyn_cast<Assign>(User))
+            A->setRight(E, A->getAssignmentOP());
+        else if (Condition *C = dyn_cast<Condition>(User))
+            Operand ? C->setRight(E) : C->setLeft(E);
+        else
+            Operand ? cast<Expr>(User)->setRight(E) : cast<Expr>(User)->setLeft(E);
+    }
+
+    // the expression inside any parentheses around E
+    Expr *skipParens(Expr *E) {
+        while (!isa<Final>(E) && !E->getRight())
+            E = E->getLeft();
+        return E;
+    }
+
+    // the number literal E is, inside any parentheses, or null
+    Final *getNumber(Expr *E) {
+        Final *F = dyn_cast<Final>(skipParens(E));
+        return F && F->getKind() == Final::Number ? F : nullptr;
+    }
+
+    // whether evaluating E may divide by zero or compute INT_MIN / -1
+    bool canTrap(Expr *E) {
+        E = skipParens(E);
+        if (isa<Final>(E))
+            return false;
+        if (E->getOperator() == Expr::Div || E->getOperator() == Expr::Mod) {
+            Final *Divisor = getNumber(E->getRight());
+            if (!Divisor || Divisor->getValue() == 0 || Divisor->getValue() == -1)
+                return true;
+        }
+        return canTrap(E->getLeft()) || canTrap(E->getRight());
+    }
+
+    // whether A and B are the same expression
+    bool isSame(Expr *A, Expr *B) {
+        A = skipParens(A);
+        B = skipParens(B);
+        Final *FA = dyn_cast<Final>(A), *FB = dyn_cast<Final>(B);
+        if (FA || FB) {
+            if (!FA || !FB || FA->getKind() != FB->getKind())
+                return false;
+            return FA->getKind() == Final::Number ? FA->getValue() == FB->getValue()
+                                                  : FA->getSymbol() == FB->getSymbol();
+        }
+        return A->getOperator() == B->getOperator() && isSame(A->getLeft(), B->getLeft()) &&
+               isSame(A->getRight(), B->getRight());
+    }
+
+    bool compare(Condition::Operator Op, int32_t L, int32_t R) {
+        switch (Op) {
+        case Condition::LessEqual: return L <= R;
+        case Condition::LessThan: return L < R;
+        case Condition::GreaterThan: return L > R;
+        case Condition::GreaterEqual: return L >= R;
+        case Condition::EqualEqual: return L == R;
+        case Condition::NotEqual: return L != R;
+        case Condition::UnsignedLessEqual: return (uint32_t)L <= (uint32_t)R;
+        case Condition::BitTest: return (uint32_t)L < 32 && ((uint32_t)R >> L & 1);
+        }
+        return false;
+    }
+
+    // whether Conds is false whatever the variables hold, judged from the
+    // comparisons of two number literals in it
+    bool isAlwaysFalse(Conditions *Conds) {
+        auto valueOf = [](Condition *Cond) -> Optional<bool> {
+            Final *L = getNumber(Cond->getLeft()), *R = getNumber(Cond->getRight());
+            if (!L || !R)
+                return None;
+            return compare(Cond->getSign(), L->getValue(), R->getValue());
+        };
+        // the and/or chain leans right, so it is reduced from its end
+        SmallVector<Conditions *, 8> Chain;
+        for (; !isa<Condition>(Conds) && Conds->getRight(); Conds = Conds->getRight())
+            Chain.push_back(Conds);
+        Condition *Last = dyn_cast<Condition>(Conds);
+        Optional<bool> Result = valueOf(Last ? Last : Conds->getLeft());
+        while (!Chain.empty()) {
+            Conditions *C = Chain.pop_back_val();
+            Optional<bool> Left = valueOf(C->getLeft());
+            bool Decisive = C->getSign() == Conditions::Or;
+            if (Left == Decisive || Result == Decisive)
+                Result = Decisive;
+            else if (!Left || !Result)
+                Result = None;
+        }
+        return Result == false;
+    }
+
+    // L Op R, or None if it would overflow, divide by zero or compute
+    // INT_MIN / -1
+    Optional<int32_t> evaluate(Expr::Operator Op, int64_t L, int64_t R) {
+        int64_t Result;
+        switch (Op) {
+        case Expr::Plus: Result = L + R; break;
+        case Expr::Minus: Result = L - R; break;
+        case Expr::Mul: Result = L * R; break;
+        case Expr::Div:
+        case Expr::Mod:
+            if (R == 0 || (L == INT32_MIN && R == -1))
+                return None;
+            Result = Op == Expr::Div ? L / R : L % R;
+            break;
+        case Expr::Pow:
+            // a negative exponent counts as zero, as in ark_ipow
+            Result = R <= 0 ? 1 : L;
+            for (int64_t I = 1; I < R && Result != 0 && Result != 1; ++I) {
+                Result *= L;
+                if (Result < INT32_MIN || Result > INT32_MAX)
+                    return None;
+            }
+            if (Result == 1 && L == -1 && R > 0)
+                Result = R % 2 ? -1 : 1;
+            break;
+        case Expr::Shl:
+            if (R < 0 || R > 30)
+                return None;
+            Result = L * ((int64_t)1 << R);
+            break;
+        }
+        if (Result < INT32_MIN || Result > INT32_MAX)
+            return None;
+        return (int32_t)Result;
+    }
+
+    // ------------------- ConstantFolder Class-------------------
+    // Sparse conditional constant propagation over the structured program.
+    // Each variable is either a known 32-bit constant or unknown, and the
+    // program is walked in order, folding constant expressions and replacing
+    // variables whose value is known by literals. The generated add/sub/mul
+    // carry nsw, so an operation that would overflow, divide by zero or
+    // compute INT_MIN / -1 is left for runtime.
+    //
+    // Conditions are evaluated to true, false or unknown. An if arm whose
+    // condition is false is unreachable and dropped, the arms after one that
+    // is always taken are dropped, and an if whose first remaining arm is
+    // always taken is replaced by that arm's assignments. Only the reachable
+    // arms are merged at the end of an if. A loop whose condition is false
+    // on entry never runs and is removed; otherwise its header values are
+    // iterated to a fixpoint, starting from the values on entry, so a
+    // variable the body never changes stays known.
+    class ConstantFolder : public StaticASTVisitor<ConstantFolder> {
+        ASTContext &Context;
+        std::vector<Optional<int32_t>> Values; // indexed by symbol ID
+        // old values of the variables changed since a checkpoint
+        std::vector<std::pair<unsigned, Optional<int32_t>>> Journal;
+        // statements replacing the one being visited
+        std::vector<Statement *> Emitted;
+        unsigned NumFolded = 0;
+        unsigned NumPruned = 0;
+
+        // One arm of an if: the else arm has no condition.
+        struct Arm {
+            Conditions *Conds;
+            MutableArrayRef<Assign *> Assignments;
+        };
+
+        void setValue(unsigned Var, Optional<int32_t> Value) {
+            Journal.emplace_back(Var, Values[Var]);
+            Values[Var] = Value;
+        }
+
+        void rollback(size_t Checkpoint) {
+            while (Journal.size() > Checkpoint) {
+                Values[Journal.back().first] = Journal.back().second;
+                Journal.pop_back();
+            }
+        }
+
+        // the variables changed since Checkpoint with their current values,
+        // each once however often it was written
+        std::vector<std::pair<unsigned, Optional<int32_t>>> changesSince(size_t Checkpoint) {
+            std::vector<std::pair<unsigned, Optional<int32_t>>> Changes;
+            SmallDenseSet<unsigned, 16> Seen;
+            for (size_t I = Checkpoint, E = Journal.size(); I != E; ++I)
+                if (Seen.insert(Journal[I].first).second)
+                    Changes.emplace_back(Journal[I].first, Values[Journal[I].first]);
+            return Changes;
+        }
+
+        Final *makeConstant(int32_t Value) {
+            ++NumFolded;
+            return new (Context) Final(Context.copyString(std::to_string(Value)), Value);
+        }
+
+        static Optional<int32_t> getConstant(Expr *E) {
+            Final *F = dyn_cast<Final>(E);
+            if (F && F->getKind() == Final::Number)
+                return (int32_t)F->getValue();
+            return None;
+        }
+
+        static Expr::Operator getOperator(Assign::AssOp Op) {
+            switch (Op) {
+            case Assign::PlusAssign: return Expr::Plus;
+            case Assign::MinusAssign: return Expr::Minus;
+            case Assign::MulAssign: return Expr::Mul;
+            case Assign::DivAssign: return Expr::Div;
+            default: return Expr::Mod;
+            }
+        }
+
+        // value of E under the current values, without rewriting it
+        Optional<int32_t> valueOf(Expr *E) {
+            if (Final *F = dyn_cast<Final>(E))
+                return F->getKind() == Final::Ident ? Values[F->getSymbol()] : (int32_t)F->getValue();
+            if (!E->getRight())
+                return valueOf(E->getLeft());
+            Optional<int32_t> L = valueOf(E->getLeft());
+            Optional<int32_t> R = valueOf(E->getRight());
+            if (!L || !R)
+                return None;
+            return evaluate(E->getOperator(), *L, *R);
+        }
+
+        // value Node stores, given the value of its right-hand side
+        Optional<int32_t> valueOf(Assign &Node, Optional<int32_t> Right) {
+            if (Node.getAssignmentOP() == Assign::EqualAssign)
+                return Right;
+            Optional<int32_t> Old = Values[Node.getLeft()->getSymbol()];
+            if (!Old || !Right)
+                return None;
+            return evaluate(getOperator(Node.getAssignmentOP()), *Old, *Right);
+        }
+
+        // true or false if Conds is decided by the current values
+        Optional<bool> valueOf(Conditions *Conds) {
+            // the and/or chain leans right, so it is reduced from its end
+            SmallVector<Conditions *, 8> Chain;
+            for (; !isa<Condition>(Conds) && Conds->getRight(); Conds = Conds->getRight())
+                Chain.push_back(Conds);
+            Condition *Last = dyn_cast<Condition>(Conds);
+            if (!Last)
+                Last = Conds->getLeft();
+            Optional<bool> Result = valueOf(Last);
+            while (!Chain.empty()) {
+                Conditions *C = Chain.pop_back_val();
+                Optional<bool> Left = valueOf(C->getLeft());
+                // a false operand decides an and, a true one decides an or
+                bool Decisive = C->getSign() == Conditions::Or;
+                if (Left == Decisive || Result == Decisive)
+                    Result = Decisive;
+                else if (!Left || !Result)
+                    Result = None;
+            }
+            return Result;
+        }
+
+        Optional<bool> valueOf(Condition *Cond) {
+            Optional<int32_t> L = valueOf(Cond->getLeft()), R = valueOf(Cond->getRight());
+            if (!L || !R)
+                return None;
+            return compare(Cond->getSign(), *L, *R);
+        }
+
+        // returns the folded expression that replaces E
+        Expr *fold(Expr *E) {
+            if (Final *F = dyn_cast<Final>(E)) {
+                if (F->getKind() == Final::Ident && Values[F->getSymbol()])
+                    return makeConstant(*Values[F->getSymbol()]);
+                return F;
+            }
+            Expr *Left = fold(E->getLeft());
+            if (!E->getRight())
+                return Left;
+            E->setLeft(Left);
+            E->setRight(fold(E->getRight()));
+            Optional<int32_t> L = getConstant(Left), R = getConstant(E->getRight());
+            if (!L || !R)
+                return E;
+            if (Optional<int32_t> Value = evaluate(E->getOperator(), *L, *R))
+                return makeConstant(*Value);
+            return E;
+        }
+
+        void foldConditions(Conditions *Conds) {
+            for (Conditions *C = Conds; C; C = C->getRight()) {
+                Condition *Cond = dyn_cast<Condition>(C);
+                if (!Cond)
+                    Cond = C->getLeft();
+                Cond->setLeft(fold(Cond->getLeft()));
+                Cond->setRight(fold(Cond->getRight()));
+                if (isa<Condition>(C))
+                    break;
+            }
+        }
+
+        // rebuilds an if from the arms that can still run
+        void emitArms(ArrayRef<Arm> Arms) {
+            if (Arms.empty())
+                return;
+            if (!Arms[0].Conds) {
+                Emitted.insert(Emitted.end(), Arms[0].Assignments.begin(), Arms[0].Assignments.end());
+                return;
+            }
+            Else *ElseBranch = nullptr;
+            if (!Arms.back().Conds) {
+                ElseBranch = new (Context) Else(Context, Arms.back().Assignments);
+                Arms = Arms.drop_back();
+            }
+            SmallVector<Elif *, 4> Elifs;
+            for (const Arm &A : Arms.drop_front())
+                Elifs.push_back(new (Context) Elif(Context, A.Conds, A.Assignments));
+            Emitted.push_back(new (Context) If(Context, Arms[0].Conds, Arms[0].Assignments, Elifs, ElseBranch));
+        }
+
+    public:
+        using StaticASTVisitor<ConstantFolder>::visit;
+
+        ConstantFolder(ASTContext &Context) : Context(Context), Values(Context.getNumSymbols()) {}
+
+        // returns the number of expressions replaced by constants
+        unsigned run(AST *Tree) {
+            dispatch(Tree);
+            return NumFolded;
+        }
+
+        // number of if arms and loops removed as unreachable or decided
+        unsigned getNumPruned() { return NumPruned; }
+
+        void visit(ARK &Node) {
+            std::vector<Statement *> Statements;
+            bool Changed = false;
+            for (Statement *S : Node.getStatements()) {
+                Emitted.clear();
+                dispatch(S);
+                Changed |= Emitted.size() != 1 || Emitted[0] != S;
+                Statements.insert(Statements.end(), Emitted.begin(), Emitted.end());
+                // nothing rolls back past a top-level statement
+                Journal.clear();
+            }
+            if (Changed)
+                Node.setStatements(Context, Statements);
+        };
+
+        void visit(Declare &Node) {
+            // each initializer runs after the variables before it are set
+            ArrayRef<unsigned> Symbols = Node.getSymbols();
+            MutableArrayRef<Expr *> Exprs = Node.getExprs();
+            for (size_t I = 0, E = Symbols.size(); I != E; ++I) {
+                if (I >= Exprs.size()) {
+                    setValue(Symbols[I], 0);
+                    continue;
+                }
+                Exprs[I] = fold(Exprs[I]);
+                setValue(Symbols[I], getConstant(Exprs[I]));
+            }
+            Emitted.push_back(&Node);
+        };
+
+        void visit(Assign &Node) {
+            Expr *Right = fold(Node.getRight());
+            Node.setRight(Right, Node.getAssignmentOP());
+            Optional<int32_t> Value = valueOf(Node, getConstant(Right));
+            if (Value && Node.getAssignmentOP() != Assign::EqualAssign)
+                Node.setRight(makeConstant(*Value), Assign::EqualAssign);
+            setValue(Node.getLeft()->getSymbol(), Value);
+            Emitted.push_back(&Node);
+        };
+
+        void visit(If &Node) {
+            SmallVector<Arm, 4> Arms;
+            Arms.push_back({Node.getConds(), Node.getAssignments()});
+            for (Elif *E : Node.getElifs())
+                Arms.push_back({E->getConds(), E->getAssignments()});
+            if (Node.getElse())
+                Arms.push_back({nullptr, Node.getElse()->getAssignments()});
+            size_t NumArms = Arms.size();
+
+            // every condition is tested with the values on entry; an arm
+            // that is always taken becomes the else of the arms before it
+            SmallVector<Arm, 4> Reachable;
+            for (Arm &A : Arms) {
+                Optional<bool> Taken = true;
+                if (A.Conds) {
+                    foldConditions(A.Conds);
+                    Taken = valueOf(A.Conds);
+                }
+                if (Taken == false)
+                    continue;
+                Reachable.push_back({Taken == true ? nullptr : A.Conds, A.Assignments});
+                if (Taken == true)
+                    break;
+            }
+            NumPruned += NumArms - Reachable.size();
+            bool FallsThrough = Reachable.empty() || Reachable.back().Conds;
+
+            // Merged[Var] is the meet of Var over the reachable arms that
+            // write it, paired with the number of those arms
+            size_t Checkpoint = Journal.size();
+            DenseMap<unsigned, std::pair<Optional<int32_t>, unsigned>> Merged;
+            for (Arm &A : Reachable) {
+                for (Assign *Assignment : A.Assignments)
+                    dispatch(Assignment);
+                for (auto &Write : changesSince(Checkpoint)) {
+                    auto Inserted = Merged.try_emplace(Write.first, Write.second, 0);
+                    auto &Entry = Inserted.first->second;
+                    if (Entry.first != Write.second)
+                        Entry.first = None;
+                    ++Entry.second;
+                }
+                rollback(Checkpoint);
+            }
+            Emitted.clear();
+
+            for (auto &Entry : Merged) {
+                Optional<int32_t> Value = Entry.second.first;
+                // a path that skips every write keeps the value on entry
+                bool Skipped = FallsThrough || Entry.second.second != Reachable.size();
+                if (Skipped && Value != Values[Entry.first])
+                    Value = None;
+                setValue(Entry.first, Value);
+            }
+
+            if (Reachable.size() == NumArms && FallsThrough == !Node.getElse())
+                Emitted.push_back(&Node);
+            else
+                emitArms(Reachable);
+        };
+
+        void visit(Loop &Node) {
+            if (valueOf(Node.getConds()) == false) {
+                ++NumPruned;
+                return;
+            }
+
+            // the header values only fall each time the body runs again
+            for (bool Changed = true; Changed;) {
+                size_t Checkpoint = Journal.size();
+                for (Assign *A : Node.getAssignments())
+                    setValue(A->getLeft()->getSymbol(), valueOf(*A, valueOf(A->getRight())));
+                auto Changes = changesSince(Checkpoint);
+                rollback(Checkpoint);
+                Changed = false;
+                for (auto &Change : Changes) {
+                    if (Values[Change.first] && Values[Change.first] != Change.second) {
+                        setValue(Change.first, None);
+                        Changed = true;
+                    }
+                }
+            }
+
+            // the loop is left from its header
+            size_t Checkpoint = Journal.size();
+            foldConditions(Node.getConds());
+            for (Assign *A : Node.getAssignments())
+                dispatch(A);
+            rollback(Checkpoint);
+            Emitted.clear();
+            Emitted.push_back(&Node);
+        };
+    };
+
+    // ------------------- EvaluatePolynomials Class-------------------
+    // Rewrites a sum of terms c * x^k in one variable x, such as
+    // a*x^3 + b*x^2 + c*x + d, into a form that raises x only to powers of
+    // two: Horner's rule up to degree 3, ((a*x + b)*x + c)*x + d, and
+    // Estrin's scheme above it, which splits the polynomial into a low and
+    // a high half, p(x) = lo(x) + hi(x) * x^(2^k), evaluated independently.
+    // Each power is built by squaring the one before, (x ^ 2) ^ 2, so CSE
+    // later computes it once for all the terms and statements that use it.
+    //
+    // The coefficients are the remaining factors of the terms and may not
+    // read x. Like the regrouped operations of reassociation, the new
+    // operations wrap instead of carrying nsw.
+    class EvaluatePolynomials {
+        // One operand of a chain, with the node holding the pointer to it.
+        struct Operand {
+            Expr *E;
+            AST *User;
+            unsigned Index;
+            bool Negative;
+        };
+
+        // A coefficient or partial result; null E stands for zero.
+        struct Signed {
+            Expr *E = nullptr;
+            bool Negative = false;
+        };
+
+        // One term: Constant times the product of Factors and x ^ Degree.
+        struct Monomial {
+            SmallVector<Expr *, 2> Factors;
+            uint32_t Constant = 1;
+            unsigned Degree = 0;
+            bool Negative = false;
+        };
+
+        // degrees above this are left alone
+        static constexpr unsigned MaxDegree = 64;
+
+        ASTContext &Context;
+        unsigned X = 0; // symbol of the variable of the current polynomial
+        StringRef XName;
+        unsigned NumPolynomials = 0;
+
+        static bool isSum(Expr *E) {
+            return !isa<Final>(E) && E->getRight() &&
+                   (E->getOperator() == Expr::Plus || E->getOperator() == Expr::Minus);
+        }
+
+        static bool isProduct(Expr *E) {
+            return !isa<Final>(E) && E->getRight() && E->getOperator() == Expr::Mul;
+        }
+
+        // the operands of the chain of Root, which IsChain accepts, left to
+        // right; Negative marks the subtracted terms of a sum
+        static void collect(Expr *Root, bool (*IsChain)(Expr *), SmallVectorImpl<Operand> &Operands) {
+            SmallVector<Operand, 8> Worklist;
+            Worklist.push_back({Root->getRight(), Root, 1, Root->getOperator() == Expr::Minus});
+            Worklist.push_back({Root->getLeft(), Root, 0, false});
+            while (!Worklist.empty()) {
+                Operand O = Worklist.pop_back_val();
+                while (!isa<Final>(O.E) && !O.E->getRight()) {
+                    O.User = O.E;
+                    O.Index = 0;
+                    O.E = O.E->getLeft();
+                }
+                if (IsChain(O.E)) {
+                    bool Flip = O.E->getOperator() == Expr::Minus;
+                    Worklist.push_back({O.E->getRight(), O.E, 1, O.Negative != Flip});
+                    Worklist.push_back({O.E->getLeft(), O.E, 0, O.Negative});
+                } else {
+                    Operands.push_back(O);
+                }
+            }
+        }
+
+        // the power of Symbol that Factor is, or None
+        static Optional<unsigned> getDegree(Expr *Factor, unsigned Symbol) {
+            Factor = skipParens(Factor);
+            Expr *Base = Factor;
+            int64_t Exponent = 1;
+            if (!isa<Final>(Factor) && Factor->getOperator() == Expr::Pow) {
+                Final *N = getNumber(Factor->getRight());
+                if (!N)
+                    return None;
+                Base = skipParens(Factor->getLeft());
+                // a negative exponent counts as zero
+                Exponent = std::max<int64_t>(N->getValue(), 0);
+            }
+            Final *F = dyn_cast<Final>(Base);
+            if (!F || F->getKind() != Final::Ident || F->getSymbol() != Symbol)
+                return None;
+            return (unsigned)std::min<int64_t>(Exponent, MaxDegree + 1);
+        }
+
+        // the variable raised to the highest power by a single term, or
+        // false if that power is below 2
+        static bool findVariable(ArrayRef<Operand> Terms, unsigned &Symbol) {
+            unsigned Best = 1;
+            SmallVector<Operand, 8> Factors;
+            SmallDenseMap<unsigned, unsigned, 8> Degrees;
+            for (const Operand &T : Terms) {
+                Factors.clear();
+                Degrees.clear();
+                if (isProduct(T.E))
+                    collect(T.E, isProduct, Factors);
+                else
+                    Factors.push_back(T);
+                for (const Operand &F : Factors) {
+                    Expr *Base = skipParens(F.E);
+                    if (!isa<Final>(Base) && Base->getOperator() == Expr::Pow)
+                        Base = skipParens(Base->getLeft());
+                    Final *V = dyn_cast<Final>(Base);
+                    if (!V || V->getKind() != Final::Ident)
+                        continue;
+                    unsigned &Degree = Degrees[V->getSymbol()];
+                    Degree += getDegree(F.E, V->getSymbol()).getValueOr(0);
+                    if (Degree > Best) {
+                        Best = Degree;
+                        Symbol = V->getSymbol();
+                    }
+                }
+            }
+            return Best > 1;
+        }
+
+        static bool reads(Expr *Root, unsigned Symbol) {
+            SmallVector<Expr *, 8> Worklist = {Root};
+            while (!Worklist.empty()) {
+                Expr *E = Worklist.pop_back_val();
+                if (Final *F = dyn_cast<Final>(E)) {
+                    if (F->getKind() == Final::Ident && F->getSymbol() == Symbol)
+                        return true;
+                    continue;
+                }
+                Worklist.push_back(E->getLeft());
+                if (E->getRight())
+                    Worklist.push_back(E->getRight());
+            }
+            return false;
+        }
+
+        Expr *makeBinary(Expr *L, Expr::Operator Op, Expr *R) {
+            Expr *E = new (Context) Expr(L, Op, R);
+            E->setNoSignedWrap(false);
+            return E;
+        }
+
+        Final *makeNumber(int32_t Value) {
+            return new (Context) Final(Context.copyString(std::to_string(Value)), Value);
+        }
+
+        // x ^ Degree as a product of repeated squares of x
+        Expr *makePower(unsigned Degree) {
+            Expr *Result = nullptr;
+            for (unsigned Bit = 0; Degree >> Bit; ++Bit) {
+                if (!(Degree >> Bit & 1))
+                    continue;
+                Expr *Square = new (Context) Final(Final::Ident, XName, X);
+                for (unsigned I = 0; I < Bit; ++I)
+                    Square = new (Context) Expr(Square, Expr::Pow, makeNumber(2));
+                Result = Result ? makeBinary(Result, Expr::Mul, Square) : Square;
+            }
+            return Result;
+        }
+
+        Signed add(Signed L, Signed R) {
+            if (!L.E)
+                return R;
+            if (!R.E)
+                return L;
+            if (L.Negative == R.Negative)
+                return {makeBinary(L.E, Expr::Plus, R.E), L.Negative};
+            if (R.Negative)
+                return {makeBinary(L.E, Expr::Minus, R.E), false};
+            return {makeBinary(R.E, Expr::Minus, L.E), false};
+        }
+
+        Signed multiplyByPower(Signed C, unsigned Degree) {
+            if (!C.E || Degree == 0)
+                return C;
+            Final *One = getNumber(C.E);
+            if (One && One->getValue() == 1)
+                return {makePower(Degree), C.Negative};
+            return {makeBinary(C.E, Expr::Mul, makePower(Degree)), C.Negative};
+        }
+
+        // the terms of degree Low to Low + Span - 1 by Estrin's scheme
+        Signed estrin(ArrayRef<Signed> Coefficients, unsigned Low, unsigned Span) {
+            if (Span == 1)
+                return Low < Coefficients.size() ? Coefficients[Low] : Signed();
+            unsigned Half = Span / 2;
+            Signed High = estrin(Coefficients, Low + Half, Half);
+            return add(estrin(Coefficients, Low, Half), multiplyByPower(High, Half));
+        }
+
+        // the polynomial in x that Terms sum, or null if it is not one
+        Expr *evaluate(ArrayRef<Operand> Terms) {
+            unsigned Symbol;
+            if (!findVariable(Terms, Symbol))
+                return nullptr;
+
+            // split every term into its degree, constant and other factors
+            SmallVector<Monomial, 8> Monomials;
+            SmallVector<Operand, 8> Factors;
+            unsigned MaxUsed = 0, NumXTerms = 0;
+            for (const Operand &T : Terms) {
+                Factors.clear();
+                if (isProduct(T.E))
+                    collect(T.E, isProduct, Factors);
+                else
+                    Factors.push_back(T);
+                Monomial M;
+                M.Negative = T.Negative;
+                for (const Operand &F : Factors) {
+                    if (Optional<unsigned> D = getDegree(F.E, Symbol))
+                        M.Degree += *D;
+                    else if (Final *N = getNumber(F.E))
+                        M.Constant *= (uint32_t)N->getValue();
+                    else if (reads(F.E, Symbol))
+                        return nullptr;
+                    else
+                        M.Factors.push_back(F.E);
+                }
+                if (M.Degree > MaxDegree)
+                    return nullptr;
+                MaxUsed = std::max(MaxUsed, M.Degree);
+                NumXTerms += M.Degree != 0;
+                Monomials.push_back(std::move(M));
+            }
+            // nothing to share when at most one term reads x
+            if (NumXTerms < 2)
+                return nullptr;
+
+            // sum the terms of each degree, with their constants last
+            SmallVector<Signed, 8> Coefficients(MaxUsed + 1);
+            SmallVector<uint32_t, 8> Constants(MaxUsed + 1, 0);
+            for (const Monomial &M : Monomials) {
+                if (M.Factors.empty()) {
+                    Constants[M.Degree] += M.Negative ? -M.Constant : M.Constant;
+                    continue;
+                }
+                Expr *Product = rewrite(M.Factors.front());
+                for (Expr *F : makeArrayRef(M.Factors).drop_front())
+                    Product = makeBinary(Product, Expr::Mul, rewrite(F));
+                if (M.Constant != 1)
+                    Product = makeBinary(Product, Expr::Mul, makeNumber(M.Constant));
+                Coefficients[M.Degree] = add(Coefficients[M.Degree], {Product, M.Negative});
+            }
+            for (unsigned D = 0; D <= MaxUsed; ++D) {
+                int32_t Constant = Constants[D];
+                if (Constant < 0 && Constant != INT32_MIN)
+                    Coefficients[D] = add(Coefficients[D], {makeNumber(-Constant), true});
+                else if (Constant)
+                    Coefficients[D] = add(Coefficients[D], {makeNumber(Constant), false});
+            }
+
+            // set only now, the coefficients may hold polynomials of their own
+            X = Symbol;
+            XName = Context.getSymbolName(X);
+            Signed Result;
+            if (MaxUsed <= 3) {
+                // Horner's rule, skipping the missing degrees
+                unsigned Last = MaxUsed;
+                for (unsigned D = MaxUsed + 1; D-- > 0;) {
+                    if (!Coefficients[D].E)
+                        continue;
+                    Result = add(multiplyByPower(Result, Last - D), Coefficients[D]);
+                    Last = D;
+                }
+                Result = multiplyByPower(Result, Last);
+            } else {
+                unsigned Span = 1;
+                while (Span <= MaxUsed)
+                    Span *= 2;
+                Result = estrin(Coefficients, 0, Span);
+            }
+            if (!Result.E)
+                return makeNumber(0);
+            if (Result.Negative)
+                return makeBinary(makeNumber(0), Expr::Minus, Result.E);
+            return Result.E;
+        }
+
+    public:
+        EvaluatePolynomials(ASTContext &Context) : Context(Context) {}
+
+        unsigned getNumRewritten() const { return NumPolynomials; }
+
+        // returns the expression that replaces E
+        Expr *rewrite(Expr *E) {
+            if (isa<Final>(E))
+                return E;
+            if (!E->getRight()) {
+                E->setLeft(rewrite(E->getLeft()));
+                return E;
+            }
+            if (!isSum(E)) {
+                E->setLeft(rewrite(E->getLeft()));
+                E->setRight(rewrite(E->getRight()));
+                return E;
+            }
+            SmallVector<Operand, 8> Terms;
+            collect(E, isSum, Terms);
+            if (Expr *Polynomial = evaluate(Terms)) {
+                ++NumPolynomials;
+                return Polynomial;
+            }
+            for (const Operand &T : Terms)
+                setOperand(T.User, T.Index, rewrite(T.E));
+            return E;
+        }
+    };
+
+    // ------------------- ReassociateExprs Class-------------------
+    // Flattens chains of + and of *, which the parser builds left-deep, and
+    // rebuilds them as balanced trees so the operations of a long chain do
+    // not all wait on each other. The constants of a chain are combined into
+    // one operand at its end. The regrouped operations may overflow where
+    // the source did not, so they wrap instead of carrying nsw; wrapping
+    // arithmetic is associative, so the result is the same whenever the
+    // source computes it without overflow.
+    class ReassociateExprs {
+        ASTContext &Context;
+        unsigned NumChains = 0;
+
+        static bool isChainOf(Expr *E, Expr::Operator Op) {
+            return !isa<Final>(E) && E->getRight() && E->getOperator() == Op;
+        }
+
+        // the operands of the Op chain rooted at Root, left to right;
+        // returns the depth of the chain
+        unsigned collect(Expr *Root, Expr::Operator Op, SmallVectorImpl<Expr *> &Operands) {
+            unsigned Depth = 0;
+            SmallVector<std::pair<Expr *, unsigned>, 8> Worklist = {{Root, 0}};
+            while (!Worklist.empty()) {
+                Expr *E = skipParens(Worklist.back().first);
+                unsigned EDepth = Worklist.pop_back_val().second;
+                if (isChainOf(E, Op)) {
+                    Worklist.push_back({E->getRight(), EDepth + 1});
+                    Worklist.push_back({E->getLeft(), EDepth + 1});
+                } else {
+                    Operands.push_back(rewrite(E));
+                    Depth = std::max(Depth, EDepth);
+                }
+            }
+            return Depth;
+        }
+
+        // puts the rewritten operands back into the chain collect() walked,
+        // which keeps its nodes and their flags
+        void reattach(Expr *E, Expr::Operator Op, ArrayRef<Expr *> Operands, size_t &Next) {
+            E = skipParens(E);
+            for (unsigned Operand = 0; Operand != 2; ++Operand) {
+                Expr *Child = Operand ? E->getRight() : E->getLeft();
+                if (isChainOf(skipParens(Child), Op))
+                    reattach(Child, Op, Operands, Next);
+                else
+                    setOperand(E, Operand, Operands[Next++]);
+            }
+        }
+
+        Expr *build(ArrayRef<Expr *> Operands, Expr::Operator Op) {
+            if (Operands.size() == 1)
+                return Operands[0];
+            size_t Half = (Operands.size() + 1) / 2;
+            Expr *E = new (Context) Expr(build(Operands.take_front(Half), Op), Op, build(Operands.drop_front(Half), Op));
+            E->setNoSignedWrap(false);
+            return E;
+        }
+
+    public:
+        ReassociateExprs(ASTContext &Context) : Context(Context) {}
+
+        unsigned getNumRebuilt() const { return NumChains; }
+
+        // returns the expression that replaces E
+        Expr *rewrite(Expr *E) {
+            E = skipParens(E);
+            if (isa<Final>(E))
+                return E;
+            Expr::Operator Op = E->getOperator();
+            if (Op != Expr::Plus && Op != Expr::Mul) {
+                E->setLeft(rewrite(E->getLeft()));
+                E->setRight(rewrite(E->getRight()));
+                return E;
+            }
+
+            SmallVector<Expr *, 8> Operands;
+            unsigned Depth = collect(E, Op, Operands);
+            // combine the constants, wrapping like the rebuilt operations
+            uint32_t Constant = Op == Expr::Plus ? 0 : 1;
+            unsigned NumConstants = 0;
+            SmallVector<Expr *, 8> Rest;
+            for (Expr *Operand : Operands) {
+                Final *F = dyn_cast<Final>(Operand);
+                if (F && F->getKind() == Final::Number) {
+                    uint32_t Value = (uint32_t)F->getValue();
+                    Constant = Op == Expr::Plus ? Constant + Value : Constant * Value;
+                    ++NumConstants;
+                } else {
+                    Rest.push_back(Operand);
+                }
+            }
+            if (Rest.empty() || Constant != (Op == Expr::Plus ? 0u : 1u))
+                Rest.push_back(new (Context) Final(Context.copyString(std::to_string((int32_t)Constant)), (int32_t)Constant));
+            // a rebuilt chain wraps, so keep the old one unless the new one
+            // is shallower or has fewer operations
+            if (Log2_32_Ceil(Rest.size()) >= Depth && Rest.size() == Operands.size()) {
+                size_t Next = 0;
+                reattach(E, Op, Operands, Next);
+                return E;
+            }
+            ++NumChains;
+            return build(Rest, Op);
+        }
+    };
+
+    // ------------------- SimplifyPeepholes Class-------------------
+    // Algebraic simplification driven by the rule tables below. Expressions
+    // are rewritten bottom-up and each node again after every rule that
+    // fires, so the result is a fixpoint of the rules. Operands a rule drops
+    // must not trap, and x * 2^k becomes the shift only the optimizer makes.
+    //
+    // Comparisons of one expression with itself are decided, and two
+    // comparisons of the same operands joined by and/or become one, since
+    // each compare accepts a subset of {<, ==, >}. Every rule counts its
+    // hits for the debug output.
+    class SimplifyPeepholes {
+        // What an operand of a rule matches.
+        enum Pattern {
+            Any,
+            Pure,       // an expression that cannot trap
+            Zero,
+            One,
+            MinusOne,
+            NotPositive,
+            PowerOfTwo, // 2 to 2^30
+            Constant,
+            SameAsLeft, // equal to the left operand, which cannot trap
+            Scaled      // x * c
+        };
+
+        // What a matching expression becomes.
+        enum Action {
+            TakeLeft,
+            TakeRight,
+            MakeZero,
+            MakeOne,
+            NegateLeft,
+            NegateRight,
+            ShiftLeft,
+            ShiftRight,
+            MergeScales
+        };
+
+        struct ExprRule {
+            const char *Name;
+            Expr::Operator Op;
+            Pattern Left, Right;
+            Action Result;
+        };
+
+        // tried in order; the first one matching a node fires
+        static ArrayRef<ExprRule> getExprRules() {
+            static const ExprRule Rules[] = {
+                {"x + 0 -> x", Expr::Plus, Any, Zero, TakeLeft},
+                {"0 + x -> x", Expr::Plus, Zero, Any, TakeRight},
+                {"x - 0 -> x", Expr::Minus, Any, Zero, TakeLeft},
+                {"x - x -> 0", Expr::Minus, Pure, SameAsLeft, MakeZero},
+                {"x * 0 -> 0", Expr::Mul, Pure, Zero, MakeZero},
+                {"0 * x -> 0", Expr::Mul, Zero, Pure, MakeZero},
+                {"x * 1 -> x", Expr::Mul, Any, One, TakeLeft},
+                {"1 * x -> x", Expr::Mul, One, Any, TakeRight},
+                {"x * -1 -> 0 - x", Expr::Mul, Any, MinusOne, NegateLeft},
+                {"-1 * x -> 0 - x", Expr::Mul, MinusOne, Any, NegateRight},
+                {"(x * c1) * c2 -> x * (c1 * c2)", Expr::Mul, Scaled, Constant, MergeScales},
+                {"x * 2^k -> x << k", Expr::Mul, Any, PowerOfTwo, ShiftLeft},
+                {"2^k * x -> x << k", Expr::Mul, PowerOfTwo, Any, ShiftRight},
+                {"x / 1 -> x", Expr::Div, Any, One, TakeLeft},
+                {"x % 1 -> 0", Expr::Mod, Pure, One, MakeZero},
+                {"x ^ c -> 1 for c <= 0", Expr::Pow, Pure, NotPositive, MakeOne},
+                {"x ^ 1 -> x", Expr::Pow, Any, One, TakeLeft},
+                {"1 ^ x -> 1", Expr::Pow, One, Pure, MakeOne},
+            };
+            return Rules;
+        }
+        enum ConditionRule { SameOperands, MergeAnd, MergeOr, DropNeutral, NumConditionRules };
+
+        static const char *getName(ConditionRule Rule) {
+            switch (Rule) {
+            case SameOperands: return "x op x -> true or false";
+            case MergeAnd: return "a op1 b and a op2 b -> a op b";
+            case MergeOr: return "a op1 b or a op2 b -> a op b";
+            default: return "c and true, c or false -> c";
+            }
+        }
+
+        // the outcomes of a three-way compare that Op accepts
+        enum { LT = 1, EQ = 2, GT = 4 };
+        static unsigned accepts(Condition::Operator Op) {
+            switch (Op) {
+            case Condition::LessEqual: return LT | EQ;
+            case Condition::LessThan: return LT;
+            case Condition::GreaterThan: return GT;
+            case Condition::GreaterEqual: return GT | EQ;
+            case Condition::EqualEqual: return EQ;
+            case Condition::NotEqual: return LT | GT;
+            default: return 0; // not a signed compare
+            }
+        }
+
+        ASTContext &Context;
+        // hits of the expression rules, then of the condition rules
+        std::vector<unsigned> Hits;
+
+        static bool matches(Pattern P, Expr *E, Expr *Left) {
+            E = skipParens(E);
+            Final *N = getNumber(E);
+            switch (P) {
+            case Any: return true;
+            case Pure: return !canTrap(E);
+            case Zero: return N && N->getValue() == 0;
+            case One: return N && N->getValue() == 1;
+            case MinusOne: return N && N->getValue() == -1;
+            case NotPositive: return N && N->getValue() <= 0;
+            case PowerOfTwo: return N && N->getValue() >= 2 && N->getValue() <= (1 << 30) && isPowerOf2_64(N->getValue());
+            case Constant: return N;
+            case SameAsLeft: return isSame(E, Left);
+            case Scaled: return !N && !isa<Final>(E) && E->getOperator() == Expr::Mul && getNumber(E->getRight());
+            }
+            return false;
+        }
+
+        Final *makeNumber(int32_t Value) {
+            return new (Context) Final(Context.copyString(std::to_string(Value)), Value);
+        }
+
+        Expr *makeBinary(Expr *L, Expr::Operator Op, Expr *R, bool NSW) {
+            Expr *E = new (Context) Expr(L, Op, R);
+            E->setNoSignedWrap(NSW);
+            return E;
+        }
+
+        Expr *apply(Action A, Expr *E) {
+            Expr *L = E->getLeft(), *R = E->getRight();
+            switch (A) {
+            case TakeLeft: return L;
+            case TakeRight: return R;
+            case MakeZero: return makeNumber(0);
+            case MakeOne: return makeNumber(1);
+            case NegateLeft: return makeBinary(makeNumber(0), Expr::Minus, L, E->hasNoSignedWrap());
+            case NegateRight: return makeBinary(makeNumber(0), Expr::Minus, R, E->hasNoSignedWrap());
+            case ShiftLeft: return makeBinary(L, Expr::Shl, makeNumber(Log2_64(getNumber(R)->getValue())), E->hasNoSignedWrap());
+            case ShiftRight: return makeBinary(R, Expr::Shl, makeNumber(Log2_64(getNumber(L)->getValue())), E->hasNoSignedWrap());
+            case MergeScales: {
+                // the product of the constants wraps; if it does, the source
+                // overflows for every x but 0, which gives 0 either way
+                Expr *Inner = skipParens(L);
+                uint32_t Scale = (uint32_t)getNumber(Inner->getRight())->getValue() *
+                                 (uint32_t)getNumber(R)->getValue();
+                return makeBinary(Inner->getLeft(), Expr::Mul, makeNumber((int32_t)Scale),
+                                  E->hasNoSignedWrap() && Inner->hasNoSignedWrap());
+            }
+            }
+            return E;
+        }
+
+        // the expression of the first rule matching E, or null
+        Expr *simplifyOnce(Expr *E) {
+            ArrayRef<ExprRule> Rules = getExprRules();
+            for (unsigned I = 0; I < Rules.size(); ++I) {
+                const ExprRule &Rule = Rules[I];
+                if (Rule.Op != E->getOperator() || !matches(Rule.Left, E->getLeft(), nullptr) ||
+                    !matches(Rule.Right, E->getRight(), E->getLeft()))
+                    continue;
+                ++Hits[I];
+                return apply(Rule.Result, E);
+            }
+            return nullptr;
+        }
+
+        Condition *makeCondition(Expr *L, unsigned Outcomes, Expr *R) {
+            if (Outcomes == 0)
+                return new (Context) Condition(makeNumber(0), Condition::NotEqual, makeNumber(0));
+            if (Outcomes == (LT | EQ | GT))
+                return new (Context) Condition(makeNumber(0), Condition::EqualEqual, makeNumber(0));
+            unsigned Op = Condition::LessEqual;
+            while (accepts((Condition::Operator)Op) != Outcomes)
+                ++Op;
+            return new (Context) Condition(L, (Condition::Operator)Op, R);
+        }
+
+        static unsigned swapOutcomes(unsigned Outcomes) {
+            return (Outcomes & EQ) | (Outcomes & LT ? GT : 0) | (Outcomes & GT ? LT : 0);
+        }
+
+        Condition *simplifyCondition(Condition *C) {
+            C->setLeft(rewrite(C->getLeft()));
+            C->setRight(rewrite(C->getRight()));
+            if (!accepts(C->getSign()) || !isSame(C->getLeft(), C->getRight()) || canTrap(C->getLeft()))
+                return C;
+            ++Hits[getExprRules().size() + SameOperands];
+            return makeCondition(nullptr, accepts(C->getSign()) & EQ ? LT | EQ | GT : 0, nullptr);
+        }
+
+        // whether C is the comparison of two constants that Sign ignores:
+        // a true operand of an and, a false one of an or
+        static bool isNeutral(Condition *C, Conditions::Operator Sign) {
+            Final *L = getNumber(C->getLeft()), *R = getNumber(C->getRight());
+            if (!L || !R || !accepts(C->getSign()))
+                return false;
+            unsigned Outcome = L->getValue() < R->getValue() ? LT : L->getValue() == R->getValue() ? EQ : GT;
+            return ((accepts(C->getSign()) & Outcome) != 0) == (Sign == Conditions::And);
+        }
+
+        // A and B joined by Sign as one comparison, or null
+        Condition *merge(Condition *A, Conditions::Operator Sign, Condition *B) {
+            if (canTrap(A->getLeft()) || canTrap(A->getRight()))
+                return nullptr;
+            unsigned OutA = accepts(A->getSign()), OutB = accepts(B->getSign());
+            if (!OutA || !OutB)
+                return nullptr;
+            if (isSame(A->getLeft(), B->getRight()) && isSame(A->getRight(), B->getLeft()))
+                OutB = swapOutcomes(OutB);
+            else if (!isSame(A->getLeft(), B->getLeft()) || !isSame(A->getRight(), B->getRight()))
+                return nullptr;
+            ++Hits[getExprRules().size() + (Sign == Conditions::And ? MergeAnd : MergeOr)];
+            return makeCondition(A->getLeft(), Sign == Conditions::And ? OutA & OutB : OutA | OutB, A->getRight());
+        }
+
+    public:
+        SimplifyPeepholes(ASTContext &Context)
+            : Context(Context), Hits(getExprRules().size() + NumConditionRules) {}
+
+        unsigned getNumSimplified() const { return std::accumulate(Hits.begin(), Hits.end(), 0u); }
+
+        // prints the rules that fired and how often
+        void printHits(raw_ostream &OS) {
+            ArrayRef<ExprRule> Rules = getExprRules();
+            for (unsigned I = 0; I < Hits.size(); ++I)
+                if (Hits[I])
+                    OS << "  " << (I < Rules.size() ? Rules[I].Name : getName((ConditionRule)(I - Rules.size())))
+                       << ": " << Hits[I] << "\n";
+        }
+
+        // returns the expression that replaces E
+        Expr *rewrite(Expr *E) {
+            if (isa<Final>(E))
+                return E;
+            E->setLeft(rewrite(E->getLeft()));
+            if (!E->getRight())
+                return E;
+            E->setRight(rewrite(E->getRight()));
+            while (!isa<Final>(E) && E->getRight()) {
+                Expr *Simplified = simplifyOnce(E);
+                if (!Simplified)
+                    break;
+                E = Simplified;
+            }
+            return E;
+        }
+
+        Conditions *rewriteConditions(Conditions *Conds) {
+            if (Condition *C = dyn_cast<Condition>(Conds))
+                return simplifyCondition(C);
+            Conds->setLeft(simplifyCondition(Conds->getLeft()));
+            Conds->setRight(rewriteConditions(Conds->getRight()));
+            if (isNeutral(Conds->getLeft(), Conds->getSign())) {
+                ++Hits[getExprRules().size() + DropNeutral];
+                return Conds->getRight();
+            }
+            if (isa<Condition>(Conds->getRight()) && isNeutral(cast<Condition>(Conds->getRight()), Conds->getSign())) {
+                ++Hits[getExprRules().size() + DropNeutral];
+                return Conds->getLeft();
+            }
+            // the chain leans right, so the left comparison is merged with
+            // the first one of the rest while their operators agree
+            while (true) {
+                Conditions *Rest = Conds->getRight();
+                Condition *Next = dyn_cast<Condition>(Rest);
+                if (!Next && Rest->getSign() == Conds->getSign())
+                    Next = Rest->getLeft();
+                Condition *Merged = Next ? merge(Conds->getLeft(), Conds->getSign(), Next) : nullptr;
+                if (!Merged)
+                    return Conds;
+                if (isa<Condition>(Rest))
+                    return Merged;
+                Conds->setLeft(Merged);
+                Conds->setRight(Rest->getRight());
+            }
+        }
+    };
+
+    // ------------------- CombineComparisons Class-------------------
+    // Condition optimizer over the runs of an and/or chain joined by one
+    // operator. A constant on the left of a comparison is first moved to
+    // the right. Then the comparisons of one expression that cannot trap
+    // with constants are combined into the set of values they accept,
+    // intersected under and and united under or, and that set is tested
+    // once where the first of them was:
+    //   one interval          x <= hi, x >= lo, x == c, or the range check
+    //                         x - lo <=u hi - lo
+    //   all but one value     x != c
+    //   values within 32      a bit test of x - lo against a mask
+    // so comparisons implied by the others disappear. A set of any other
+    // shape keeps its comparisons. Moving a combined test forward is safe:
+    // under and it only passes when all of its comparisons do, and under
+    // or it only fails when all of them do, so the comparisons after it run
+    // in no more cases than before.
+    class CombineComparisons {
+        using Interval = std::pair<int64_t, int64_t>;
+        using ValueSet = SmallVector<Interval, 2>; // sorted and disjoint
+
+        // The comparisons of one expression in a run.
+        struct Group {
+            Expr *Operand;
+            SmallVector<unsigned, 4> Members;
+            ValueSet Values;
+            Condition *Test = nullptr; // replacing the members, if any
+        };
+
+        ASTContext &Context;
+        unsigned NumSwapped = 0;
+        unsigned NumCombined = 0; // comparisons replaced by fewer tests
+        unsigned NumTests = 0;    // tests replacing them
+        unsigned NumBitTests = 0;
+
+        static Condition::Operator mirror(Condition::Operator Op) {
+            switch (Op) {
+            case Condition::LessEqual: return Condition::GreaterEqual;
+            case Condition::LessThan: return Condition::GreaterThan;
+            case Condition::GreaterThan: return Condition::LessThan;
+            case Condition::GreaterEqual: return Condition::LessEqual;
+            default: return Op;
+            }
+        }
+
+        // the values of x that x Op C accepts, or false if Op is not a
+        // signed compare
+        static bool getValues(Condition::Operator Op, int64_t C, ValueSet &Values) {
+            switch (Op) {
+            case Condition::LessEqual: Values = {{INT32_MIN, C}}; break;
+            case Condition::LessThan: Values = {{INT32_MIN, C - 1}}; break;
+            case Condition::GreaterThan: Values = {{C + 1, INT32_MAX}}; break;
+            case Condition::GreaterEqual: Values = {{C, INT32_MAX}}; break;
+            case Condition::EqualEqual: Values = {{C, C}}; break;
+            case Condition::NotEqual: Values = {{INT32_MIN, C - 1}, {C + 1, INT32_MAX}}; break;
+            default: return false;
+            }
+            // drop the empty intervals at the ends of the range
+            Values.erase(std::remove_if(Values.begin(), Values.end(),
+                                        [](const Interval &I) { return I.first > I.second; }),
+                         Values.end());
+            return true;
+        }
+
+        static ValueSet intersect(const ValueSet &A, const ValueSet &B) {
+            ValueSet Result;
+            for (const Interval &I : A)
+                for (const Interval &J : B)
+                    if (std::max(I.first, J.first) <= std::min(I.second, J.second))
+                        Result.push_back({std::max(I.first, J.first), std::min(I.second, J.second)});
+            llvm::sort(Result);
+            return Result;
+        }
+
+        static ValueSet unite(const ValueSet &A, const ValueSet &B) {
+            ValueSet All(A.begin(), A.end());
+            All.append(B.begin(), B.end());
+            llvm::sort(All);
+            ValueSet Result;
+            for (const Interval &I : All) {
+                if (!Result.empty() && I.first <= Result.back().second + 1)
+                    Result.back().second = std::max(Result.back().second, I.second);
+                else
+                    Result.push_back(I);
+            }
+            return Result;
+        }
+
+        Final *makeNumber(int32_t Value) {
+            return new (Context) Final(Context.copyString(std::to_string(Value)), Value);
+        }
+
+        // X - Low, wrapping, or X itself for a zero Low
+        Expr *makeOffset(Expr *X, int64_t Low) {
+            if (Low == 0)
+                return X;
+            Expr *E = new (Context) Expr(X, Expr::Minus, makeNumber((int32_t)Low));
+            E->setNoSignedWrap(false);
+            return E;
+        }
+
+        // one test of X against Values, or null if it takes more than one
+        Condition *makeTest(Expr *X, const ValueSet &Values) {
+            if (Values.empty())
+                return new (Context) Condition(makeNumber(0), Condition::NotEqual, makeNumber(0));
+            int64_t Low = Values.front().first, High = Values.back().second;
+            if (Values.size() == 1) {
+                if (Low == INT32_MIN && High == INT32_MAX)
+                    return new (Context) Condition(makeNumber(0), Condition::EqualEqual, makeNumber(0));
+                if (Low == High)
+                    return new (Context) Condition(X, Condition::EqualEqual, makeNumber(Low));
+                if (Low == INT32_MIN)
+                    return new (Context) Condition(X, Condition::LessEqual, makeNumber(High));
+                if (High == INT32_MAX)
+                    return new (Context) Condition(X, Condition::GreaterEqual, makeNumber(Low));
+                return new (Context) Condition(makeOffset(X, Low), Condition::UnsignedLessEqual,
+                                               makeNumber((int32_t)(High - Low)));
+            }
+            if (Values.size() == 2 && Low == INT32_MIN && High == INT32_MAX &&
+                Values[1].first - Values[0].second == 2)
+                return new (Context) Condition(X, Condition::NotEqual, makeNumber(Values[0].second + 1));
+            if (High - Low >= 32)
+                return nullptr;
+            uint32_t Mask = 0;
+            for (const Interval &I : Values)
+                for (int64_t V = I.first; V <= I.second; ++V)
+                    Mask |= 1u << (V - Low);
+            ++NumBitTests;
+            return new (Context) Condition(makeOffset(X, Low), Condition::BitTest, makeNumber((int32_t)Mask));
+        }
 
-namespace OptimizationMethods{
-    std::map<StringRef, std::vector<StringRef>> variablesDependencyList;
-    std::vector<StringRef> liveVars;
+        // moves a constant left operand to the right
+        void canonicalize(Condition *C) {
+            if (!getNumber(C->getLeft()) || getNumber(C->getRight()))
+                return;
+            Expr *L = C->getLeft();
+            C->setLeft(C->getRight());
+            C->setRight(L);
+            C->setSign(mirror(C->getSign()));
+            ++NumSwapped;
+        }
 
+    public:
+        CombineComparisons(ASTContext &Context) : Context(Context) {}
 
-    // ------------------- DetectDeadVars Class-------------------
-    class DetectDeadVars : public ASTVisitor {
-        StringRef currentVar;
-        StringRef goalVar;
+        void printStats(raw_ostream &OS) {
+            OS << "Combined " << NumCombined << " comparisons into " << NumTests << " tests ("
+               << NumBitTests << " bit tests), swapped " << NumSwapped << " constant operands\n";
+        }
 
-    public:
-        void debug() {
-            llvm::errs() << "\n--------------------\n";
-            for (const auto& pair : variablesDependencyList) {
-                const StringRef& key = pair.first;
-                const std::vector<StringRef>& list = pair.second;
+        // returns the chain that replaces Conds
+        Conditions *rewriteConditions(Conditions *Conds) {
+            if (Condition *C = dyn_cast<Condition>(Conds)) {
+                canonicalize(C);
+                return C;
+            }
 
-                llvm::errs() << "Var: " << key << "\n";
-                llvm::errs() << "DependedOn: ";
-                for (StringRef var : list) {
-                    llvm::errs() << var << " ";
+            // the run: the comparisons joined by the operator of Conds, then
+            // a chain joined by the other operator, if any
+            Conditions::Operator Sign = Conds->getSign();
+            SmallVector<Condition *, 8> Run;
+            Conditions *Tail = nullptr, *OldTail = nullptr;
+            for (Conditions *C = Conds;; C = C->getRight()) {
+                Run.push_back(C->getLeft());
+                Conditions *Rest = C->getRight();
+                if (Condition *Last = dyn_cast<Condition>(Rest)) {
+                    Run.push_back(Last);
+                    break;
                 }
-                llvm::errs() << "\n--------------------\n";
+                if (Rest->getSign() != Sign) {
+                    OldTail = Rest;
+                    Tail = rewriteConditions(Rest);
+                    break;
+                }
+            }
+
+            SmallVector<Group, 4> Groups;
+            SmallVector<int, 8> GroupOf(Run.size(), -1);
+            for (unsigned I = 0; I < Run.size(); ++I) {
+                Condition *C = Run[I];
+                canonicalize(C);
+                Final *N = getNumber(C->getRight());
+                ValueSet Values;
+                if (!N || getNumber(C->getLeft()) || canTrap(C->getLeft()) ||
+                    !getValues(C->getSign(), N->getValue(), Values))
+                    continue;
+                auto G = llvm::find_if(Groups, [&](const Group &G) { return isSame(G.Operand, C->getLeft()); });
+                if (G == Groups.end()) {
+                    Groups.push_back({C->getLeft(), {}, Values});
+                    G = Groups.end() - 1;
+                } else {
+                    G->Values = Sign == Conditions::And ? intersect(G->Values, Values) : unite(G->Values, Values);
+                }
+                G->Members.push_back(I);
+                GroupOf[I] = G - Groups.begin();
+            }
+
+            // replace each group of two or more by one test at its first member
+            bool Changed = false;
+            for (Group &G : Groups) {
+                if (G.Members.size() < 2 || !(G.Test = makeTest(G.Operand, G.Values)))
+                    continue;
+                NumCombined += G.Members.size();
+                ++NumTests;
+                Changed = true;
+            }
+            if (!Changed && Tail == OldTail)
+                return Conds;
+            SmallVector<Condition *, 8> NewRun;
+            for (unsigned I = 0; I < Run.size(); ++I) {
+                Group *G = GroupOf[I] < 0 ? nullptr : &Groups[GroupOf[I]];
+                if (!G || !G->Test)
+                    NewRun.push_back(Run[I]);
+                else if (G->Members.front() == I)
+                    NewRun.push_back(G->Test);
+            }
+
+            Conditions *Result = Tail ? Tail : NewRun.pop_back_val();
+            while (!NewRun.empty())
+                Result = new (Context) Conditions(NewRun.pop_back_val(), Sign, Result);
+            return Result;
+        }
+    };
+
+    // ------------------- RewriteExpressions Class-------------------
+    // Runs the rewrites above on every expression of the program: the
+    // initializers, the right sides of the assignments and the conditions.
+    // Each works on one expression at a time, so they run back to back per
+    // expression in a single walk rather than walking a large program once
+    // per rewrite.
+    class RewriteExpressions : public StaticASTVisitor<RewriteExpressions> {
+        EvaluatePolynomials Polynomials;
+        ReassociateExprs Chains;
+        SimplifyPeepholes Peepholes;
+        CombineComparisons Comparisons;
+
+        Expr *rewrite(Expr *E) {
+            return Peepholes.rewrite(Chains.rewrite(Polynomials.rewrite(E)));
+        }
+
+        // the peepholes rewrite the comparisons themselves before merging
+        Conditions *rewrite(Conditions *Conds) {
+            for (Conditions *C = Conds; C; C = C->getRight()) {
+                Condition *Cond = dyn_cast<Condition>(C);
+                if (!Cond)
+                    Cond = C->getLeft();
+                Cond->setLeft(Chains.rewrite(Polynomials.rewrite(Cond->getLeft())));
+                Cond->setRight(Chains.rewrite(Polynomials.rewrite(Cond->getRight())));
+                if (isa<Condition>(C))
+                    break;
+            }
+            return Comparisons.rewriteConditions(Peepholes.rewriteConditions(Conds));
+        }
+
+    public:
+        using StaticASTVisitor<RewriteExpressions>::visit;
+
+        RewriteExpressions(ASTContext &Context) : Polynomials(Context), Chains(Context), Peepholes(Context), Comparisons(Context) {}
+
+        void run(AST *Tree) { dispatch(Tree); }
+
+        void printStats(raw_ostream &OS) {
+            OS << "Rewrote " << Polynomials.getNumRewritten() << " polynomials by Horner's rule or Estrin's scheme\n";
+            OS << "Rebalanced " << Chains.getNumRebuilt() << " chains of + and *\n";
+            OS << "Simplified " << Peepholes.getNumSimplified() << " expressions and conditions\n";
+            Peepholes.printHits(OS);
+            Comparisons.printStats(OS);
+        }
+
+        void visit(ARK &Node) {
+            for (Statement *S : Node.getStatements())
+                dispatch(S);
+        };
+
+        void visit(Declare &Node) {
+            for (Expr *&E : Node.getExprs())
+                E = rewrite(E);
+        };
+
+        void visit(Assign &Node) {
+            Node.setRight(rewrite(Node.getRight()), Node.getAssignmentOP());
+        };
+
+        void visit(If &Node) {
+            Node.setConds(rewrite(Node.getConds()));
+            for (Assign *A : Node.getAssignments())
+                dispatch(A);
+            for (Elif *E : Node.getElifs()) {
+                E->setConds(rewrite(E->getConds()));
+                for (Assign *A : E->getAssignments())
+                    dispatch(A);
+            }
+            if (Node.getElse())
+                for (Assign *A : Node.getElse()->getAssignments())
+                    dispatch(A);
+        };
+
+        void visit(Loop &Node) {
+            Node.setConds(rewrite(Node.getConds()));
+            for (Assign *A : Node.getAssignments())
+                dispatch(A);
+        };
+    };
+
+    // ------------------- HoistLoopInvariants Class-------------------
+    // Loop-invariant code motion. An expression reading no variable that
+    // the loop body writes has the same value on every iteration, so the
+    // largest such subtrees of the condition and the body are computed once
+    // into temporaries __licmN declared right before the loop.
+    //
+    // Only the first condition of the loop is sure to run; the body and the
+    // later conditions may not run at all. There, an expression only moves
+    // when it cannot trap: no division or remainder unless the divisor is a
+    // constant other than 0 and -1.
+    class HoistLoopInvariants : public StaticASTVisitor<HoistLoopInvariants> {
+        struct Info {
+            bool Invariant;
+            bool Safe; // evaluating it cannot trap
+        };
+
+        ASTContext &Context;
+        BitVector Written; // variables written by the current loop
+        std::vector<Statement *> Preheader; // definitions for the current loop
+        bool Speculative = false;
+        unsigned NumTemps = 0;
+
+        static bool isBinary(Expr *E) {
+            while (!isa<Final>(E) && !E->getRight())
+                E = E->getLeft();
+            return !isa<Final>(E);
+        }
+
+        bool canMove(Expr *E, Info I) {
+            return I.Invariant && (I.Safe || !Speculative) && isBinary(E);
+        }
+
+        // moves E out of the loop; User reads the temporary instead
+        void hoist(AST *User, unsigned Operand, Expr *E) {
+            StringRef Name = Context.copyString("__licm" + std::to_string(NumTemps++));
+            Preheader.push_back(new (Context) Declare(Context, Name, E));
+            setOperand(User, Operand, new (Context) Final(Final::Ident, Name, Context.intern(Name)));
+        }
+
+        // Checks E bottom-up. A subtree that can move is left to its user,
+        // which moves it whole or as part of a larger one; any other node
+        // moves its operands that can.
+        Info analyze(Expr *E) {
+            if (Final *F = dyn_cast<Final>(E))
+                return {F->getKind() == Final::Number || !Written.test(F->getSymbol()), true};
+            if (!E->getRight())
+                return analyze(E->getLeft());
+            Info L = analyze(E->getLeft());
+            Info R = analyze(E->getRight());
+            Info Result = {L.Invariant && R.Invariant, L.Safe && R.Safe};
+            if (E->getOperator() == Expr::Div || E->getOperator() == Expr::Mod) {
+                Final *Divisor = dyn_cast<Final>(E->getRight());
+                Result.Safe &= Divisor && Divisor->getKind() == Final::Number &&
+                               Divisor->getValue() != 0 && Divisor->getValue() != -1;
+            }
+            if (!canMove(E, Result)) {
+                if (canMove(E->getLeft(), L))
+                    hoist(E, 0, E->getLeft());
+                if (canMove(E->getRight(), R))
+                    hoist(E, 1, E->getRight());
+            }
+            return Result;
+        }
+
+        void hoistFrom(AST *User, unsigned Operand, Expr *E) {
+            if (canMove(E, analyze(E)))
+                hoist(User, Operand, E);
+        }
+
+    public:
+        using StaticASTVisitor<HoistLoopInvariants>::visit;
+
+        HoistLoopInvariants(ASTContext &Context) : Context(Context) {}
+
+        // returns the number of expressions moved out of loops
+        unsigned run(AST *Tree) {
+            dispatch(Tree);
+            return NumTemps;
+        }
+
+        void visit(ARK &Node) {
+            std::vector<Statement *> Statements;
+            for (Statement *S : Node.getStatements()) {
+                Preheader.clear();
+                dispatch(S);
+                Statements.insert(Statements.end(), Preheader.begin(), Preheader.end());
+                Statements.push_back(S);
+            }
+            if (Statements.size() != Node.getStatements().size())
+                Node.setStatements(Context, Statements);
+        };
+
+        void visit(Loop &Node) {
+            Written.clear();
+            Written.resize(Context.getNumSymbols());
+            for (Assign *A : Node.getAssignments())
+                Written.set(A->getLeft()->getSymbol());
+
+            Speculative = false;
+            for (Conditions *C = Node.getConds(); C; C = C->getRight()) {
+                Condition *Cond = dyn_cast<Condition>(C);
+                if (!Cond)
+                    Cond = C->getLeft();
+                hoistFrom(Cond, 0, Cond->getLeft());
+                hoistFrom(Cond, 1, Cond->getRight());
+                // the conditions after the first may be skipped
+                Speculative = true;
+                if (isa<Condition>(C))
+                    break;
             }
+            Speculative = true;
+            for (Assign *A : Node.getAssignments())
+                hoistFrom(A, 0, A->getRight());
+            Speculative = false;
+        };
+    };
+
+    // ------------------- EliminateCommonSubexprs Class-------------------
+    // Value numbering over straight-line regions: the top-level statement
+    // list and the body of every if arm and loop. A variable gets a new
+    // version at each write, so two expressions share a value number only
+    // when they apply the same operator to the same versions of the same
+    // variables; + and * number their operands in order. A binary
+    // expression evaluated more than once in a region is computed once into
+    // a temporary __cseN right before the statement of its first occurrence,
+    // and every occurrence reads the temporary instead.
+    //
+    // Only the first condition of an if always runs. An occurrence in a
+    // later condition may reuse a temporary but never defines one, so no
+    // division is evaluated speculatively. Loop conditions run once per
+    // iteration and are left to loop-invariant code motion.
+    class EliminateCommonSubexprs : public StaticASTVisitor<EliminateCommonSubexprs> {
+        // One evaluation of a binary expression; recorded in pre-order, so
+        // the occurrences nested in one directly follow it.
+        struct Occurrence {
+            Expr *Node;
+            AST *User; // node holding the pointer to Node
+            unsigned Operand; // which operand of User Node is
+            unsigned VN = 0;
+            unsigned Stmt = 0; // statement of the region evaluating it
+            unsigned End = 0; // one past the last occurrence nested in it
+            unsigned PostOrder = 0;
+            unsigned Ops = 0; // binary operations in the subtree
+            bool Speculative = false;
+            bool Alive = false; // still evaluated once the chosen ones are replaced
+            int Temp = -1; // index of the temporary that replaces it, or -1
+        };
+
+        // A temporary and the expression it is computed from, to be
+        // defined before statement Stmt of the region.
+        struct TempDef {
+            unsigned Stmt, PostOrder, Symbol;
+            StringRef Name;
+            Expr *Value;
+        };
+
+        // value number of an expression reading a variable that is written
+        // by the statement evaluating it, which therefore cannot move
+        static constexpr unsigned Pinned = ~0u;
+        enum { NumberTag = Expr::Shl + 1, IdentTag };
+
+        ASTContext &Context;
+        DenseMap<std::tuple<unsigned, unsigned, unsigned>, unsigned> Numbers;
+        std::vector<unsigned> Versions; // indexed by symbol ID
+        unsigned NumVersions = 0;
+        BitVector PinnedVars;
+        std::vector<Occurrence> Occurrences; // of the current region
+        unsigned CurrentStmt = 0;
+        unsigned NextPostOrder = 0;
+        bool Speculative = false;
+        unsigned NumTemps = 0;
+        unsigned NumEliminated = 0;
+        // declarations of the temporaries of if arms and loop bodies, with
+        // the top-level statement they go before
+        std::vector<std::pair<unsigned, Declare *>> NestedDecls;
+
+        unsigned lookup(unsigned Tag, unsigned A, unsigned B) {
+            return Numbers.try_emplace(std::make_tuple(Tag, A, B), Numbers.size()).first->second;
+        }
 
-            llvm::errs() << "LiveVars: ";
+        void write(unsigned Var) { Versions[Var] = ++NumVersions; }
 
-            for (const auto& liveVar : liveVars) {
-                llvm::errs() << liveVar << " ";
+        // numbers E and the binary expressions in it; Ops is increased by
+        // the number of binary operations
+        unsigned number(Expr *E, AST *User, unsigned Operand, unsigned &Ops) {
+            if (Final *F = dyn_cast<Final>(E)) {
+                if (F->getKind() == Final::Number)
+                    return lookup(NumberTag, (uint32_t)F->getValue(), 0);
+                if (PinnedVars.test(F->getSymbol()))
+                    return Pinned;
+                return lookup(IdentTag, F->getSymbol(), Versions[F->getSymbol()]);
             }
-            llvm::errs() << "\n--------------------\n\n";
+            if (!E->getRight())
+                return number(E->getLeft(), E, 0, Ops);
+
+            unsigned Index = Occurrences.size();
+            Occurrences.push_back({E, User, Operand});
+            unsigned SubOps = 0;
+            unsigned L = number(E->getLeft(), E, 0, SubOps);
+            unsigned R = number(E->getRight(), E, 1, SubOps);
+            Ops += SubOps + 1;
+
+            Occurrence &O = Occurrences[Index];
+            O.Stmt = CurrentStmt;
+            O.End = Occurrences.size();
+            O.PostOrder = NextPostOrder++;
+            O.Ops = SubOps + 1;
+            O.Speculative = Speculative;
+            O.Alive = L != Pinned && R != Pinned;
+            if (!O.Alive)
+                return O.VN = Pinned;
+            Expr::Operator Op = E->getOperator();
+            if ((Op == Expr::Plus || Op == Expr::Mul) && L > R)
+                std::swap(L, R);
+            return O.VN = lookup(Op, L, R);
         }
 
-        void findLiveVars(StringRef Var) {      
-            auto dependedOnVarsMap = variablesDependencyList.find(Var);
-            if(dependedOnVarsMap == variablesDependencyList.end()) return;
+        void numberConditions(Conditions *Conds, bool AlwaysRuns) {
+            Speculative = !AlwaysRuns;
+            for (Conditions *C = Conds; C; C = C->getRight()) {
+                Condition *Cond = dyn_cast<Condition>(C);
+                if (!Cond)
+                    Cond = C->getLeft();
+                unsigned Ops = 0;
+                number(Cond->getLeft(), Cond, 0, Ops);
+                number(Cond->getRight(), Cond, 1, Ops);
+                // the conditions after the first may be skipped
+                Speculative = true;
+                if (isa<Condition>(C))
+                    break;
+            }
+            Speculative = false;
+        }
 
-            std::vector<StringRef>& dependedOnVarsList = dependedOnVarsMap->second;
+        Final *makeUse(const TempDef &Def) {
+            return new (Context) Final(Final::Ident, Def.Name, Def.Symbol);
+        }
 
-            for (const auto& dVar : dependedOnVarsList) {
-                auto iter = std::find(liveVars.begin(), liveVars.end(), dVar);
-                if (iter == liveVars.end()) {
-                    liveVars.push_back(dVar);
+        // Chooses the expressions of the current region to compute once and
+        // makes their occurrences read temporaries. Returns the definitions
+        // of the temporaries, a nested one before the one containing it.
+        std::vector<TempDef> eliminate() {
+            DenseMap<unsigned, unsigned> FirstStmt; // of an occurrence that always runs
+            for (Occurrence &O : Occurrences)
+                if (O.Alive && !O.Speculative)
+                    FirstStmt.try_emplace(O.VN, O.Stmt);
+            DenseMap<unsigned, SmallVector<unsigned, 2>> ByNumber;
+            for (unsigned I = 0, E = Occurrences.size(); I != E; ++I) {
+                Occurrence &O = Occurrences[I];
+                if (O.Alive && O.Speculative) {
+                    auto It = FirstStmt.find(O.VN);
+                    O.Alive = It != FirstStmt.end() && It->second <= O.Stmt;
                 }
-                if(dVar != goalVar && !dVar.equals(Var)) {
-                    findLiveVars(dVar);
+                if (O.Alive)
+                    ByNumber[O.VN].push_back(I);
+            }
+
+            // larger expressions first: the occurrences nested in a replaced
+            // one are no longer evaluated and do not count
+            SmallVector<unsigned, 16> Candidates;
+            for (auto &Entry : ByNumber)
+                if (Entry.second.size() > 1)
+                    Candidates.push_back(Entry.second[0]);
+            llvm::sort(Candidates, [&](unsigned A, unsigned B) {
+                if (Occurrences[A].Ops != Occurrences[B].Ops)
+                    return Occurrences[A].Ops > Occurrences[B].Ops;
+                return A < B;
+            });
+
+            std::vector<TempDef> Defs;
+            for (unsigned First : Candidates) {
+                SmallVector<unsigned, 4> Live;
+                for (unsigned I : ByNumber[Occurrences[First].VN])
+                    if (Occurrences[I].Alive)
+                        Live.push_back(I);
+                if (Live.size() < 2 || Occurrences[Live[0]].Speculative)
+                    continue;
+                Occurrence &Def = Occurrences[Live[0]];
+                Def.Temp = Defs.size();
+                Defs.push_back({Def.Stmt, Def.PostOrder, 0, StringRef(), Def.Node});
+                for (unsigned I : makeArrayRef(Live).drop_front()) {
+                    Occurrence &O = Occurrences[I];
+                    O.Temp = Def.Temp;
+                    NumEliminated += O.Ops;
+                    for (unsigned J = I + 1; J != O.End; ++J)
+                        Occurrences[J].Alive = false;
                 }
             }
+
+            // the temporaries are named in the order they are defined
+            SmallVector<unsigned, 16> Order(Defs.size());
+            std::iota(Order.begin(), Order.end(), 0);
+            llvm::sort(Order, [&](unsigned A, unsigned B) {
+                return std::make_pair(Defs[A].Stmt, Defs[A].PostOrder) < std::make_pair(Defs[B].Stmt, Defs[B].PostOrder);
+            });
+            std::vector<TempDef> Sorted;
+            for (unsigned I : Order) {
+                Defs[I].Name = Context.copyString("__cse" + std::to_string(NumTemps++));
+                Defs[I].Symbol = Context.intern(Defs[I].Name);
+                Sorted.push_back(Defs[I]);
+            }
+
+            for (Occurrence &O : Occurrences)
+                if (O.Alive && O.Temp >= 0)
+                    setOperand(O.User, O.Operand, makeUse(Defs[O.Temp]));
+            Occurrences.clear();
+            return Sorted;
         }
 
-        void run(AST *Tree, std::string goalVarName) {
-            Tree->accept(*this);
+        // eliminates in the body of Branch, a region of its own whose
+        // temporaries are declared before the enclosing statement
+        template <typename BranchT>
+        void eliminateInBody(BranchT *Branch) {
+            std::vector<Occurrence> Outer;
+            std::swap(Outer, Occurrences);
+            unsigned OuterStmt = CurrentStmt;
 
-            llvm::StringRef goalVarStringRef(goalVarName);
-            goalVar = goalVarStringRef;
+            MutableArrayRef<Assign *> Body = Branch->getAssignments();
+            for (CurrentStmt = 0; CurrentStmt != Body.size(); ++CurrentStmt)
+                dispatch(Body[CurrentStmt]);
+            std::vector<TempDef> Defs = eliminate();
+            if (!Defs.empty()) {
+                std::vector<Assign *> NewBody;
+                auto Def = Defs.begin();
+                for (unsigned I = 0, E = Body.size(); I != E; ++I) {
+                    for (; Def != Defs.end() && Def->Stmt == I; ++Def) {
+                        NestedDecls.emplace_back(OuterStmt, new (Context) Declare(Context, Def->Name, {}));
+                        NewBody.push_back(new (Context) Assign(makeUse(*Def), Assign::EqualAssign, Def->Value));
+                    }
+                    NewBody.push_back(Body[I]);
+                }
+                Branch->setAssignments(Context, NewBody);
+            }
 
-            liveVars.clear();
-            liveVars.push_back(goalVar);
-            findLiveVars(goalVar);
+            std::swap(Outer, Occurrences);
+            CurrentStmt = OuterStmt;
+        }
 
-            if(debugMode) {
-                debug();
-            };
+    public:
+        using StaticASTVisitor<EliminateCommonSubexprs>::visit;
+
+        EliminateCommonSubexprs(ASTContext &Context)
+            : Context(Context), Versions(Context.getNumSymbols()), PinnedVars(Context.getNumSymbols()) {}
+
+        // returns the number of binary operations no longer evaluated
+        unsigned run(AST *Tree) {
+            dispatch(Tree);
+            return NumEliminated;
         }
-        
-        virtual void visit(ARK &Node) override {
-            for (SmallVector<Statement *>::const_iterator I = Node.begin(), E = Node.end(); I != E; ++I) {
-                (*I)->accept(*this); // Visit each child node
+
+        void visit(ARK &Node) {
+            MutableArrayRef<Statement *> Statements = Node.getStatements();
+            for (CurrentStmt = 0; CurrentStmt != Statements.size(); ++CurrentStmt)
+                dispatch(Statements[CurrentStmt]);
+            std::vector<TempDef> Defs = eliminate();
+            if (Defs.empty() && NestedDecls.empty())
+                return;
+
+            std::vector<Statement *> NewStatements;
+            auto Def = Defs.begin();
+            auto Decl = NestedDecls.begin();
+            for (unsigned I = 0, E = Statements.size(); I != E; ++I) {
+                for (; Decl != NestedDecls.end() && Decl->first == I; ++Decl)
+                    NewStatements.push_back(Decl->second);
+                for (; Def != Defs.end() && Def->Stmt == I; ++Def)
+                    NewStatements.push_back(new (Context) Declare(Context, Def->Name, Def->Value));
+                NewStatements.push_back(Statements[I]);
+            }
+            Node.setStatements(Context, NewStatements);
+        };
+
+        void visit(Declare &Node) {
+            // an initializer may read the variables declared before it in
+            // the same statement, so those reads cannot move above it
+            ArrayRef<unsigned> Symbols = Node.getSymbols();
+            for (unsigned Var : Symbols)
+                PinnedVars.set(Var);
+            MutableArrayRef<Expr *> Exprs = Node.getExprs();
+            for (unsigned I = 0, E = Exprs.size(); I != E; ++I) {
+                unsigned Ops = 0;
+                number(Exprs[I], &Node, I, Ops);
+            }
+            for (unsigned Var : Symbols) {
+                PinnedVars.reset(Var);
+                write(Var);
             }
         };
 
-        virtual void visit(Declare &Node) override {
-            Value *val = nullptr;
-            
-            currentVar = *(Node.VarsBegin());
-            if (variablesDependencyList.count(currentVar) > 0) {
-                // Clear the list associated with the currentVar key
-                variablesDependencyList[currentVar].clear();
+        void visit(Assign &Node) {
+            unsigned Ops = 0;
+            number(Node.getRight(), &Node, 0, Ops);
+            write(Node.getLeft()->getSymbol());
+        };
+
+        void visit(If &Node) {
+            numberConditions(Node.getConds(), true);
+            for (Elif *E : Node.getElifs())
+                numberConditions(E->getConds(), false);
+            eliminateInBody(&Node);
+            for (Elif *E : Node.getElifs())
+                eliminateInBody(E);
+            if (Node.getElse())
+                eliminateInBody(Node.getElse());
+        };
+
+        void visit(Loop &Node) {
+            eliminateInBody(&Node);
+        };
+    };
+
+    // ------------------- DetectDeadVars Class-------------------
+    // Builds the control-flow graph of the program and solves backward
+    // liveness on it. A definition only makes its operands live when the
+    // variable it writes is live afterwards, so a chain of dead assignments
+    // is found in one fixpoint instead of one round per link. Loops are
+    // handled by iterating until no live-in set changes.
+    class DetectDeadVars : public StaticASTVisitor<DetectDeadVars> {
+        ASTContext &Context;
+        CFG &Graph;
+        const OutputSet &Outputs;
+        bool DebugMode;
+        unsigned Current = 0; // block that receives the next statement
+        // Seen[Var] holds the number of the last use list that recorded
+        // Var, so each variable is recorded once per list
+        std::vector<unsigned> Seen;
+        unsigned CurrentList = 0;
+
+        void beginUses() { ++CurrentList; }
+
+        void addUse(unsigned Var) {
+            if (Seen[Var] == CurrentList) return;
+            Seen[Var] = CurrentList;
+            Graph.Uses.push_back(Var);
+        }
+
+        void addDefinition(Statement *Stmt, unsigned Index, unsigned Var, unsigned UsesBegin, bool Observable) {
+            Graph.Blocks[Current].Defs.push_back({Stmt, Index, Var, UsesBegin, (unsigned)Graph.Uses.size(), Observable});
+        }
+
+        // ends the current block with a condition of region R
+        unsigned addCondition(Conditions *Conds, int R) {
+            Graph.Blocks[Current].CondOf = R;
+            Graph.Blocks[Current].CondUsesBegin = Graph.Uses.size();
+            beginUses();
+            dispatch(Conds);
+            Graph.Blocks[Current].CondUsesEnd = Graph.Uses.size();
+            Graph.Regions[R].CondBlocks.push_back(Current);
+            return Current;
+        }
+
+        // starts a block of region R holding Assignments
+        unsigned addBody(ArrayRef<Assign *> Assignments, int R) {
+            Current = Graph.addBlock(R);
+            for (Assign *A : Assignments)
+                dispatch(A);
+            return Current;
+        }
+
+        // liveness through block B, backwards from its live-out set in Live;
+        // with Record the liveness of each definition is stored
+        void transfer(Block &B, BitVector &Live, bool Record) {
+            if (B.CondOf >= 0 && Graph.Regions[B.CondOf].Useful)
+                for (unsigned I = B.CondUsesBegin; I != B.CondUsesEnd; ++I)
+                    Live.set(Graph.Uses[I]);
+            for (auto D = B.Defs.rbegin(), E = B.Defs.rend(); D != E; ++D) {
+                bool IsLive = D->Observable || Live.test(D->Var);
+                if (Record)
+                    D->Live = IsLive;
+                if (!IsLive)
+                    continue;
+                Live.reset(D->Var);
+                for (unsigned I = D->UsesBegin; I != D->UsesEnd; ++I)
+                    Live.set(Graph.Uses[I]);
+            }
+        }
+
+        void liveOut(unsigned Index, BitVector &Live) {
+            Live.reset();
+            if (Index == Graph.Exit)
+                for (unsigned Var : Outputs.getSymbols().set_bits())
+                    Live.set(Var);
+            for (unsigned Succ : Graph.Blocks[Index].Succs)
+                Live |= Graph.Blocks[Succ].LiveIn;
+        }
+
+        // a live definition in a body makes the conditions of its region live
+        bool markUseful(const Block &B) {
+            if (B.Region < 0 || Graph.Regions[B.Region].Useful)
+                return false;
+            if (llvm::none_of(B.Defs, [](const Definition &D) { return D.Live; }))
+                return false;
+            Graph.Regions[B.Region].Useful = true;
+            return true;
+        }
+
+        void solve() {
+            unsigned NumBlocks = Graph.Blocks.size();
+            BitVector Live(Context.getNumSymbols());
+            for (Block &B : Graph.Blocks)
+                B.LiveIn.resize(Context.getNumSymbols());
+
+            // blocks are created in program order, so popping from the back
+            // visits them roughly backwards
+            std::vector<unsigned> Worklist;
+            BitVector InList(NumBlocks, true);
+            for (unsigned I = 0; I != NumBlocks; ++I)
+                Worklist.push_back(I);
+
+            auto push = [&](unsigned Index) {
+                if (InList.test(Index)) return;
+                InList.set(Index);
+                Worklist.push_back(Index);
+            };
+
+            while (!Worklist.empty()) {
+                unsigned Index = Worklist.back();
+                Worklist.pop_back();
+                InList.reset(Index);
+
+                Block &B = Graph.Blocks[Index];
+                liveOut(Index, Live);
+                transfer(B, Live, /*Record=*/true);
+                if (markUseful(B))
+                    for (unsigned Cond : Graph.Regions[B.Region].CondBlocks)
+                        push(Cond);
+                if (Live == B.LiveIn)
+                    continue;
+                B.LiveIn = Live;
+                for (unsigned Pred : B.Preds)
+                    push(Pred);
+            }
+        }
+
+    public:
+        using StaticASTVisitor<DetectDeadVars>::visit;
+
+        DetectDeadVars(ASTContext &Context, CFG &Graph, const OutputSet &Outputs, bool DebugMode)
+            : Context(Context), Graph(Graph), Outputs(Outputs), DebugMode(DebugMode), Seen(Context.getNumSymbols(), 0) {}
+
+        void debug() {
+            llvm::errs() << "\n--------------------\n";
+            for (unsigned I = 0, E = Graph.Blocks.size(); I != E; ++I) {
+                const Block &B = Graph.Blocks[I];
+                llvm::errs() << "Block " << I << " -> ";
+                for (unsigned Succ : B.Succs)
+                    llvm::errs() << Succ << " ";
+                llvm::errs() << "\nLiveIn: ";
+                for (unsigned Var : B.LiveIn.set_bits())
+                    llvm::errs() << Context.getSymbolName(Var) << " ";
+                llvm::errs() << "\n--------------------\n";
+            }
+            llvm::errs() << "\n";
+        }
+
+        void run(AST *Tree) {
+            Current = Graph.addBlock();
+            dispatch(Tree);
+            Graph.Exit = Current;
+
+            solve();
+
+            if(DebugMode) {
+                debug();
+            };
+        }
+
+        void visit(ARK &Node) {
+            for (ArrayRef<Statement *>::const_iterator I = Node.begin(), E = Node.end(); I != E; ++I) {
+                dispatch((*I)); // Visit each child node
             }
+        };
 
-            llvm::SmallVector<Expr *>::const_iterator L = Node.ExprsBegin();
-            llvm::SmallVector<Expr *>::const_iterator R = Node.ExprsEnd();
+        void visit(Declare &Node) {
+            ArrayRef<unsigned> Symbols = Node.getSymbols();
+            ArrayRef<Expr *> Exprs = Node.getExprs();
 
-            if (L != R) {
-                (*L)->accept(*this);
+            // each variable is written with its initializer, or with zero
+            for (size_t I = 0, E = Symbols.size(); I != E; ++I) {
+                unsigned UsesBegin = Graph.Uses.size();
+                beginUses();
+                if (I < Exprs.size())
+                    dispatch(Exprs[I]);
+                addDefinition(&Node, I, Symbols[I], UsesBegin, false);
             }
         };
 
-        virtual void visit(Assign &Node) override {
+        void visit(Assign &Node) {
             // Get the name of the variable being assigned.
-            currentVar = Node.getLeft()->getVal();
-            
-            if (Node.getAssignmentOP() == Assign::EqualAssign && variablesDependencyList.count(currentVar) > 0) {
-                // Clear the list associated with the currentVar key
-                variablesDependencyList[currentVar].clear();
+            unsigned Var = Node.getLeft()->getSymbol();
+
+            unsigned UsesBegin = Graph.Uses.size();
+            beginUses();
+            // a compound assignment also reads the old value
+            if (Node.getAssignmentOP() != Assign::EqualAssign)
+                addUse(Var);
+            // Visit the right-hand side of the assignment and collect its uses.
+            dispatch(Node.getRight());
+            addDefinition(&Node, 0, Var, UsesBegin, Outputs.contains(Var));
+        };
+
+        void visit(If &Node) {
+            int R = Graph.Regions.size();
+            Graph.Regions.emplace_back();
+            unsigned Join = Graph.addBlock();
+
+            // each test branches to its arm or to the next test
+            unsigned Test = addCondition(Node.getConds(), R);
+            Graph.addEdge(Test, addBody(Node.getAssignments(), R));
+            Graph.addEdge(Current, Join);
+            for (Elif *E : Node.getElifs()) {
+                Current = Graph.addBlock();
+                Graph.addEdge(Test, Current);
+                Test = addCondition(E->getConds(), R);
+                Graph.addEdge(Test, addBody(E->getAssignments(), R));
+                Graph.addEdge(Current, Join);
             }
+            if (Node.getElse()) {
+                Graph.addEdge(Test, addBody(Node.getElse()->getAssignments(), R));
+                Graph.addEdge(Current, Join);
+            } else {
+                Graph.addEdge(Test, Join);
+            }
+            Current = Join;
+        };
+
+        void visit(Loop &Node) {
+            int R = Graph.Regions.size();
+            Graph.Regions.emplace_back();
+            // whether the loop ends is observable, so its conditions stay
+            // live unless it never runs
+            Graph.Regions[R].Useful = !isAlwaysFalse(Node.getConds());
+
+            unsigned Header = Graph.addBlock();
+            Graph.addEdge(Current, Header);
+            Current = Header;
+            addCondition(Node.getConds(), R);
+            Graph.addEdge(Header, addBody(Node.getAssignments(), R));
+            Graph.addEdge(Current, Header);
 
-            // Visit the right-hand side of the assignment and get its value.
-            Node.getRight()->accept(*this);   
+            unsigned Exit = Graph.addBlock();
+            Graph.addEdge(Header, Exit);
+            Current = Exit;
         };
 
-        virtual void visit(Expr &Node) override {
-            // Visit the left-hand side of the binary operation and get its value.
-            Node.getLeft()->accept(*this);
+        void visit(Expr &Node) {
+            // Visit the left-hand side of the binary operation.
+            dispatch(Node.getLeft());
 
-            // Visit the right-hand side of the binary operation and get its value.
-            Value *Right;
+            // Visit the right-hand side of the binary operation.
             if(Node.getRight()) {
-                Node.getRight()->accept(*this);
+                dispatch(Node.getRight());
+            }
+        };
+
+        void visit(Conditions &Node) {
+            for (Conditions *C = &Node; C; C = C->getRight()) {
+                if (isa<Condition>(C)) {
+                    dispatch(C);
+                    break;
+                }
+                dispatch(C->getLeft());
             }
         };
 
-        virtual void visit(Final &Node) override {
+        void visit(Condition &Node) {
+            dispatch(Node.getLeft());
+            dispatch(Node.getRight());
+        };
+
+        void visit(Final &Node) {
             if (Node.getKind() == Final::Ident) {
-                variablesDependencyList[currentVar].push_back(Node.getVal());
+                addUse(Node.getSymbol());
             }
         };
     };
 
-    // ------------------- RemoveDeadVars Class-------------------
-    class RemoveDeadVars : public ASTVisitor {
-        StringRef currentVar;
-        std::vector<Statement*> statementsToRemove;
+    // ------------------- CollectReferences Class-------------------
+    // Marks every variable that a statement reads or writes.
+    class CollectReferences : public StaticASTVisitor<CollectReferences> {
+        BitVector &Referenced;
 
     public:
-        void debug(ARK &Node) {
-            for (SmallVector<Statement *>::const_iterator I = Node.begin(), E = Node.end(); I != E; ++I) {
-                (*I)->accept(*this); // Visit each child node
+        using StaticASTVisitor<CollectReferences>::visit;
+
+        CollectReferences(BitVector &Referenced) : Referenced(Referenced) {}
+
+        void visit(Declare &Node) {
+            for (Expr *E : Node.getExprs())
+                dispatch(E);
+        };
+
+        void visit(Assign &Node) {
+            Referenced.set(Node.getLeft()->getSymbol());
+            dispatch(Node.getRight());
+        };
+
+        void visit(If &Node) {
+            dispatch(Node.getConds());
+            for (Assign *A : Node.getAssignments())
+                dispatch(A);
+            for (Elif *E : Node.getElifs()) {
+                dispatch(E->getConds());
+                for (Assign *A : E->getAssignments())
+                    dispatch(A);
+            }
+            if (Node.getElse())
+                for (Assign *A : Node.getElse()->getAssignments())
+                    dispatch(A);
+        };
+
+        void visit(Loop &Node) {
+            dispatch(Node.getConds());
+            for (Assign *A : Node.getAssignments())
+                dispatch(A);
+        };
+
+        void visit(Expr &Node) {
+            dispatch(Node.getLeft());
+            if (Node.getRight())
+                dispatch(Node.getRight());
+        };
+
+        void visit(Conditions &Node) {
+            for (Conditions *C = &Node; C; C = C->getRight()) {
+                if (isa<Condition>(C)) {
+                    dispatch(C);
+                    break;
+                }
+                dispatch(C->getLeft());
             }
+        };
+
+        void visit(Condition &Node) {
+            dispatch(Node.getLeft());
+            dispatch(Node.getRight());
+        };
+
+        void visit(Final &Node) {
+            if (Node.getKind() == Final::Ident)
+                Referenced.set(Node.getSymbol());
+        };
+    };
+
+    // ------------------- RemoveDeadVars Class-------------------
+    class RemoveDeadVars : public StaticASTVisitor<RemoveDeadVars> {
+        ASTContext &Context;
+        const OutputSet &Outputs;
+        bool DebugMode;
+        bool Dead; // set by visiting a statement
+        SmallPtrSet<Statement *, 32> DeadAssigns;
+
+        bool isDead(AST *Stmt) {
+            Dead = false;
+            dispatch(Stmt);
+            return Dead;
         }
 
-        void run(AST *Tree) {
-            Tree->accept(*this);
+        // returns whether the body of Branch is empty afterwards
+        template <typename BranchT>
+        bool removeDeadAssignments(BranchT *Branch) {
+            Branch->eraseAssignmentsIf([this](Assign *A) { return isDead(A); });
+            return Branch->getAssignments().empty();
         }
-        
-        virtual void visit(ARK& Node) override {
-            if(debugMode) {
-                llvm::errs() << "*********** Removed Variables with their Declaration or Assignments: ***********\n";
+
+        // A declaration is needed while the remaining program still names
+        // one of its variables. Declarations only appear at the top level
+        // and before every use, so one backward pass settles all of them.
+        void removeUnusedDeclarations(ARK &Node) {
+            BitVector Referenced(Context.getNumSymbols());
+            for (unsigned Var : Outputs.getSymbols().set_bits())
+                Referenced.set(Var);
+            CollectReferences Collect(Referenced);
+            MutableArrayRef<Statement *> Statements = Node.getStatements();
+            SmallPtrSet<Statement *, 32> Unused;
+            for (auto I = Statements.rbegin(), E = Statements.rend(); I != E; ++I) {
+                Declare *D = dyn_cast<Declare>(*I);
+                if (D && llvm::none_of(D->getSymbols(), [&](unsigned Var) { return Referenced.test(Var); })) {
+                    Unused.insert(D);
+                    continue;
+                }
+                Collect.dispatch(*I);
             }
+            Node.eraseStatementsIf([&](Statement *S) {
+                if (!Unused.count(S))
+                    return false;
+                if (DebugMode)
+                    for (StringRef Var : cast<Declare>(S)->getVars())
+                        llvm::errs() << "\tRemoved -> " << Var << "\n";
+                return true;
+            });
+        }
 
-            for (SmallVector<Statement*>::const_iterator I = Node.begin(), E = Node.end(); I != E; ++I) {
-                (*I)->accept(*this); // Visit each child node
+    public:
+        using StaticASTVisitor<RemoveDeadVars>::visit;
 
-                auto iter = std::find(liveVars.begin(), liveVars.end(), currentVar);
-                if (iter == liveVars.end()) {
-                    // Add the current item to the removal list
-                    statementsToRemove.push_back(*I);
+        RemoveDeadVars(ASTContext &Context, const OutputSet &Outputs, bool DebugMode)
+            : Context(Context), Outputs(Outputs), DebugMode(DebugMode) {}
 
-                    if (debugMode) {
-                        llvm::errs() << "\tRemoved -> " << currentVar << "\n";
+        void run(AST *Tree, CFG &Graph) {
+            for (Block &B : Graph.Blocks) {
+                for (Definition &D : B.Defs) {
+                    if (D.Live)
+                        continue;
+                    Declare *Decl = dyn_cast<Declare>(D.Stmt);
+                    if (!Decl) {
+                        DeadAssigns.insert(D.Stmt);
+                        continue;
                     }
+                    // the declaration may have to stay, but its dead
+                    // initializer must not read variables whose writes are
+                    // removed
+                    MutableArrayRef<Expr *> Exprs = Decl->getExprs();
+                    if (D.Index >= Exprs.size())
+                        continue;
+                    Final *Init = dyn_cast<Final>(Exprs[D.Index]);
+                    if (!Init || Init->getKind() != Final::Number)
+                        Exprs[D.Index] = new (Context) Final("0", 0);
                 }
             }
+            dispatch(Tree);
+        }
+
+        void visit(ARK &Node) {
+            if(DebugMode) {
+                llvm::errs() << "*********** Removed Variables with their Declaration or Assignments: ***********\n";
+            }
 
-            if(debugMode) {
+            // drop every dead statement in one pass over the list
+            Node.eraseStatementsIf([this](Statement *S) { return isDead(S); });
+            removeUnusedDeclarations(Node);
+
+            if(DebugMode) {
                 llvm::errs() << "********************************************************************************\n\n";
             }
+        };
 
-            // Remove the statements marked for removal
-            for (Statement* stmt : statementsToRemove) {
-                Node.erase(stmt);
+        void visit(Assign &Node) {
+            if (!DeadAssigns.count(&Node))
+                return;
+            Dead = true;
+            if (DebugMode) {
+                llvm::errs() << "\tRemoved -> " << Node.getLeft()->getVal() << "\n";
             }
         };
 
-        virtual void visit(Declare &Node) override {
-            Value *val = nullptr;
-            
-            currentVar = *(Node.VarsBegin());
+        // Empty arms at the end of an if do nothing and are dropped; an if
+        // left without arms goes away, and so does a loop that never runs
+        // once its body is empty.
+        void visit(If &Node) {
+            bool Empty = removeDeadAssignments(&Node);
+            MutableArrayRef<Elif *> Elifs = Node.getElifs();
+            for (Elif *E : Elifs)
+                removeDeadAssignments(E);
+            if (Node.getElse() && removeDeadAssignments(Node.getElse()))
+                Node.setElse(nullptr);
+            if (!Node.getElse()) {
+                size_t Trailing = 0;
+                while (Trailing != Elifs.size() && Elifs[Elifs.size() - 1 - Trailing]->getAssignments().empty())
+                    ++Trailing;
+                Node.dropElifs(Trailing);
+            }
+            Dead = Empty && Node.getElifs().empty() && !Node.getElse();
+            if (Dead && DebugMode)
+                llvm::errs() << "\tRemoved -> if\n";
         };
 
-        virtual void visit(Assign &Node) override {
-            // Get the name of the variable being assigned.
-            currentVar = Node.getLeft()->getVal();
+        void visit(Loop &Node) {
+            // a body that no longer changes the conditions leaves them
+            // false on every test or true on every test, and a loop that
+            // never ends must stay
+            Dead = removeDeadAssignments(&Node) && isAlwaysFalse(Node.getConds());
+            if (Dead && DebugMode)
+                llvm::errs() << "\tRemoved -> loopc\n";
         };
+    };
+
+    // ------------------- FlatOptimizer Class-------------------
+    // Cleans up a FlatAST with scans over its node arrays. Binary nodes
+    // whose operands are literals are folded in place, assignments and
+    // initializers whose value is never read or printed are dropped, and
+    // the arrays are compacted without the nodes and declarations nothing
+    // uses any more.
+    // Values are not propagated through variables, and there is no common
+    // subexpression or loop work; those passes need the tree.
+    //
+    // Liveness is computed in one backward scan. The value of a statement
+    // is the run of expression nodes right before it, and bodies only hold
+    // assignments, so an if or a loop is the one region the scan has to
+    // know about. Inside an if arm an assignment only hides the variable
+    // from the arms before it while that arm is scanned; in a loop body a
+    // variable read anywhere in the loop is live all through it.
+    class FlatOptimizer {
+        FlatAST &Tree;
+        const OutputSet &Outputs;
+        BitVector Live; // variables read later, indexed by symbol ID
+        std::vector<bool> Dead; // dropped assignments and initializers
+        unsigned NumFolded = 0;
+        unsigned NumRemoved = 0;
+
+        static bool isExpression(FlatAST::NodeKind Kind) { return Kind <= FlatAST::Logical; }
+
+        // first node of the value or condition that ends right before User
+        uint32_t runStart(uint32_t User) {
+            while (User > 0 && isExpression(Tree.Kinds[User - 1]))
+                --User;
+            return User;
+        }
+
+        // marks the variables read by the value or condition of User live
+        uint32_t addUses(uint32_t User) {
+            uint32_t Start = runStart(User);
+            for (uint32_t I = Start; I != User; ++I)
+                if (Tree.Kinds[I] == FlatAST::Ident)
+                    Live.set(Tree.LHS[I]);
+            return Start;
+        }
+
+        // Keeps or drops the assignment or initializer I. A kept one that
+        // overwrites its variable hides it from the statements before;
+        // inside an if arm it is noted in Killed to be undone after the arm.
+        uint32_t visitStore(uint32_t I, SmallVectorImpl<unsigned> *Killed) {
+            unsigned Var = Tree.LHS[I];
+            bool Printed = Tree.Kinds[I] == FlatAST::Store && Outputs.contains(Var);
+            if (!Printed && !Live.test(Var)) {
+                Dead[I] = true;
+                ++NumRemoved;
+                return runStart(I);
+            }
+            if (Tree.Kinds[I] == FlatAST::Store && Tree.Ops[I] != Assign::EqualAssign) {
+                Live.set(Var);
+            } else if (Live.test(Var)) {
+                Live.reset(Var);
+                if (Killed)
+                    Killed->push_back(Var);
+            }
+            return addUses(I);
+        }
+
+        // returns the first node of the if statement whose branch is If
+        uint32_t visitIf(uint32_t If) {
+            uint32_t End = Tree.RHS[If];
+            SmallVector<uint32_t, 8> Arms;
+            for (uint32_t I = If; I != End; ++I)
+                if (Tree.Kinds[I] >= FlatAST::IfBranch && Tree.Kinds[I] <= FlatAST::ElseBranch)
+                    Arms.push_back(I);
+
+            uint32_t BodyEnd = End;
+            SmallVector<unsigned, 8> Killed;
+            while (!Arms.empty()) {
+                uint32_t Arm = Arms.pop_back_val();
+                for (uint32_t I = BodyEnd; I > Arm + 1;)
+                    I = visitStore(I - 1, &Killed);
+                for (unsigned Var : Killed)
+                    Live.set(Var);
+                Killed.clear();
+                BodyEnd = Tree.Kinds[Arm] == FlatAST::ElseBranch ? Arm : addUses(Arm);
+            }
+            return BodyEnd;
+        }
+
+        // returns the first node of the loop whose body starts at Body
+        uint32_t visitLoop(uint32_t Body) {
+            uint32_t End = Tree.RHS[Body];
+            uint32_t Start = addUses(Body);
+            for (uint32_t I = Body + 1; I != End; ++I)
+                if (Tree.Kinds[I] == FlatAST::Store)
+                    Dead[I] = true;
+            // keep the assignments to variables read after the loop, by its
+            // condition or by an assignment kept so far, until none is added
+            for (bool Changed = true; Changed;) {
+                Changed = false;
+                for (uint32_t I = End; I > Body + 1;) {
+                    uint32_t Store = I - 1;
+                    I = runStart(Store);
+                    unsigned Var = Tree.LHS[Store];
+                    if (!Dead[Store] || !(Outputs.contains(Var) || Live.test(Var)))
+                        continue;
+                    Dead[Store] = false;
+                    if (Tree.Ops[Store] != Assign::EqualAssign)
+                        Live.set(Var);
+                    addUses(Store);
+                    Changed = true;
+                }
+            }
+            for (uint32_t I = Body + 1; I != End; ++I)
+                NumRemoved += Dead[I];
+            return Start;
+        }
+
+    public:
+        FlatOptimizer(FlatAST &Tree, ASTContext &Context, const OutputSet &Outputs)
+            : Tree(Tree), Outputs(Outputs), Live(Context.getNumSymbols()) {}
+
+        unsigned getNumFolded() { return NumFolded; }
+        unsigned getNumRemoved() { return NumRemoved; }
+
+        // operands come before their user, so one forward scan folds
+        // nested literal expressions too
+        void foldConstants() {
+            for (uint32_t I = 0, E = Tree.size(); I != E; ++I) {
+                if (Tree.Kinds[I] != FlatAST::Binary)
+                    continue;
+                uint32_t L = Tree.LHS[I], R = Tree.RHS[I];
+                if (Tree.Kinds[L] != FlatAST::Number || Tree.Kinds[R] != FlatAST::Number)
+                    continue;
+                Optional<int32_t> Value =
+                    evaluate((Expr::Operator)Tree.Ops[I], (int32_t)Tree.LHS[L], (int32_t)Tree.LHS[R]);
+                if (!Value)
+                    continue;
+                Tree.Kinds[I] = FlatAST::Number;
+                Tree.Ops[I] = 0;
+                Tree.LHS[I] = (uint32_t)*Value;
+                Tree.RHS[I] = FlatAST::None;
+                ++NumFolded;
+            }
+        }
+
+        void removeDeadStores() {
+            Dead.assign(Tree.size(), false);
+            // the if statements and loops, found without entering them
+            std::vector<uint32_t> Regions;
+            for (uint32_t I = 0, E = Tree.size(); I != E;) {
+                if (Tree.Kinds[I] == FlatAST::IfBranch || Tree.Kinds[I] == FlatAST::LoopBody) {
+                    Regions.push_back(I);
+                    I = Tree.RHS[I];
+                } else {
+                    ++I;
+                }
+            }
+
+            for (uint32_t I = Tree.size(); I > 0;) {
+                if (!Regions.empty() && Tree.RHS[Regions.back()] == I) {
+                    uint32_t Branch = Regions.back();
+                    Regions.pop_back();
+                    I = Tree.Kinds[Branch] == FlatAST::IfBranch ? visitIf(Branch) : visitLoop(Branch);
+                } else if (Tree.Kinds[I - 1] == FlatAST::Store || Tree.Kinds[I - 1] == FlatAST::Init) {
+                    I = visitStore(I - 1, nullptr);
+                } else {
+                    --I;
+                }
+            }
+        }
 
-        virtual void visit(Expr &Node) override {};
+        // Drops the dead statements, the nodes no statement uses and the
+        // declarations of variables nothing uses, and renumbers the rest.
+        // Users come after their operands and declarations before every
+        // use, so one backward scan finds what is still used.
+        void compact() {
+            uint32_t Size = Tree.size();
+            std::vector<bool> Used(Size);
+            BitVector &Referenced = Live;
+            Referenced.reset();
+            for (uint32_t I = Size; I-- > 0;) {
+                switch (Tree.Kinds[I]) {
+                case FlatAST::Store:
+                case FlatAST::Init:
+                    Used[I] = !Dead[I];
+                    if (Used[I]) {
+                        Used[Tree.RHS[I]] = true;
+                        Referenced.set(Tree.LHS[I]);
+                    }
+                    break;
+                case FlatAST::Ident:
+                    if (Used[I])
+                        Referenced.set(Tree.LHS[I]);
+                    break;
+                case FlatAST::DeclVar:
+                    Used[I] = Referenced.test(Tree.LHS[I]);
+                    break;
+                case FlatAST::Binary:
+                case FlatAST::Compare:
+                case FlatAST::Logical:
+                    if (Used[I])
+                        Used[Tree.LHS[I]] = Used[Tree.RHS[I]] = true;
+                    break;
+                case FlatAST::IfBranch:
+                case FlatAST::ElifBranch:
+                case FlatAST::LoopBody:
+                    Used[I] = true;
+                    Used[Tree.LHS[I]] = true;
+                    break;
+                case FlatAST::ElseBranch:
+                    Used[I] = true;
+                    break;
+                default:
+                    break;
+                }
+            }
+
+            // NewIndex[I] is the index node I moves to, or that of the next
+            // node kept; NewIndex[Size] is the new size
+            std::vector<uint32_t> NewIndex(Size + 1);
+            uint32_t Next = 0;
+            for (uint32_t I = 0; I != Size; ++I) {
+                NewIndex[I] = Next;
+                Next += Used[I];
+            }
+            NewIndex[Size] = Next;
 
-        virtual void visit(Final &Node) override {};
+            for (uint32_t I = 0; I != Size; ++I) {
+                if (!Used[I])
+                    continue;
+                uint32_t J = NewIndex[I];
+                uint32_t L = Tree.LHS[I], R = Tree.RHS[I];
+                switch (Tree.Kinds[I]) {
+                case FlatAST::Binary:
+                case FlatAST::Compare:
+                case FlatAST::Logical:
+                case FlatAST::IfBranch:
+                case FlatAST::ElifBranch:
+                case FlatAST::LoopBody:
+                    L = NewIndex[L];
+                    R = NewIndex[R];
+                    break;
+                case FlatAST::Store:
+                case FlatAST::Init:
+                case FlatAST::ElseBranch:
+                    R = NewIndex[R];
+                    break;
+                default:
+                    break;
+                }
+                Tree.Kinds[J] = Tree.Kinds[I];
+                Tree.Ops[J] = Tree.Ops[I];
+                Tree.LHS[J] = L;
+                Tree.RHS[J] = R;
+            }
+            Tree.Kinds.resize(Next);
+            Tree.Ops.resize(Next);
+            Tree.LHS.resize(Next);
+            Tree.RHS.resize(Next);
+        }
     };
 }
 
-void Optimizer::optimize(AST *Tree, bool enableDebugMode) {
-    debugMode = enableDebugMode;
-    std::string goalVar = "result";
-    OptimizationMethods::DetectDeadVars *detectDeadVars = new OptimizationMethods::DetectDeadVars();
-    detectDeadVars->run(Tree, goalVar);
+void Optimizer::optimize(AST *Tree, ASTContext &Context, const OutputSet &Outputs, bool enableDebugMode) {
+    OptimizationMethods::ConstantFolder constantFolder(Context);
+    unsigned NumFolded = constantFolder.run(Tree);
+    if (enableDebugMode)
+        llvm::errs() << "Folded " << NumFolded << " constant expressions, pruned "
+                     << constantFolder.getNumPruned() << " branches and loops\n";
 
-    OptimizationMethods::RemoveDeadVars *removeDeadVars = new OptimizationMethods::RemoveDeadVars();
-    removeDeadVars->run(Tree);
-}
\ No newline at end of file
+    OptimizationMethods::RewriteExpressions rewriteExpressions(Context);
+    rewriteExpressions.run(Tree);
+    if (enableDebugMode)
+        rewriteExpressions.printStats(llvm::errs());
+
+    OptimizationMethods::HoistLoopInvariants hoistLoopInvariants(Context);
+    unsigned NumHoisted = hoistLoopInvariants.run(Tree);
+    if (enableDebugMode)
+        llvm::errs() << "Hoisted " << NumHoisted << " loop-invariant expressions\n";
+
+    OptimizationMethods::EliminateCommonSubexprs eliminateCommonSubexprs(Context);
+    unsigned NumEliminated = eliminateCommonSubexprs.run(Tree);
+    if (enableDebugMode)
+        llvm::errs() << "Eliminated " << NumEliminated << " operations by reusing common subexpressions\n";
+
+    OptimizationMethods::CFG Graph;
+
+    OptimizationMethods::DetectDeadVars detectDeadVars(Context, Graph, Outputs, enableDebugMode);
+    detectDeadVars.run(Tree);
+
+    OptimizationMethods::RemoveDeadVars removeDeadVars(Context, Outputs, enableDebugMode);
+    removeDeadVars.run(Tree, Graph);
+}
+
+void Optimizer::optimize(FlatAST &Tree, ASTContext &Context, const OutputSet &Outputs, bool enableDebugMode) {
+    OptimizationMethods::FlatOptimizer flatOptimizer(Tree, Context, Outputs);
+    flatOptimizer.foldConstants();
+    flatOptimizer.removeDeadStores();
+    flatOptimizer.compact();
+    if (enableDebugMode)
+        llvm::errs() << "Folded " << flatOptimizer.getNumFolded() << " constant expressions, removed "
+                     << flatOptimizer.getNumRemoved() << " dead assignments\n";
+}
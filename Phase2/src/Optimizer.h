@@ -2,11 +2,14 @@
 #define OPTIMIZER_H
 
 #include "AST.h"
+#include "FlatAST.h"
+#include "OutputSet.h"
 
 class Optimizer
 {
 public:
- void optimize(AST *Tree, bool debuenableDebugModegMode);
+ void optimize(AST *Tree, ASTContext &Context, const OutputSet &Outputs, bool enableDebugMode);
+ void optimize(FlatAST &Tree, ASTContext &Context, const OutputSet &Outputs, bool enableDebugMode);
 
 };
-#endif
\ No newline at end of file
+#endif
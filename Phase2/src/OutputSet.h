@@ -0,0 +1,49 @@
+#ifndef OUTPUTSET_H
+#define OUTPUTSET_H
+
+#include "llvm/ADT/BitVector.h"
+
+// The variables whose writes are observable: code generation emits an
+// ark_write call after each assignment to them, and dead-code elimination
+// treats those assignments and their final values as live. Either a set of
+// symbol IDs or every variable of the program as written; temporaries the
+// optimizer introduces later are never outputs.
+class OutputSet
+{
+    bool AllWrites = false;
+    unsigned NumProgramSymbols = 0;
+    llvm::BitVector Symbols;
+
+public:
+    OutputSet() = default;
+
+    // every assignment to one of the first NumSymbols symbols is printed
+    static OutputSet allWrites(unsigned NumSymbols)
+    {
+        OutputSet Outputs;
+        Outputs.AllWrites = true;
+        Outputs.NumProgramSymbols = NumSymbols;
+        return Outputs;
+    }
+
+    void add(unsigned Symbol)
+    {
+        if (Symbol >= Symbols.size())
+            Symbols.resize(Symbol + 1);
+        Symbols.set(Symbol);
+    }
+
+    bool isAllWrites() const { return AllWrites; }
+
+    bool contains(unsigned Symbol) const
+    {
+        if (AllWrites)
+            return Symbol < NumProgramSymbols;
+        return Symbol < Symbols.size() && Symbols.test(Symbol);
+    }
+
+    // the listed output variables; empty when every write is an output
+    const llvm::BitVector &getSymbols() const { return Symbols; }
+};
+
+#endif
@@ -1,80 +1,115 @@
 #include "Parser.h"
 
-// main point is that the whole input has been consumed
-AST *Parser::parse()
+// binary operators of expressions and conditions, by token kind
+namespace binop
 {
-    AST *Res = parseARK();
-    return Res;
+    // binding strength of an operator, higher binds tighter
+    enum Precedence : unsigned char
+    {
+        Prec_None,
+        Prec_Logical,        // and or
+        Prec_Compare,        // == != < > <= >=
+        Prec_Additive,       // + -
+        Prec_Multiplicative, // * / %
+        Prec_Power           // ^
+    };
+
+    // Op is an Expr::Operator, Condition::Operator or Conditions::Operator
+    // depending on Prec
+    struct OperatorInfo
+    {
+        Precedence Prec;
+        unsigned char Op;
+    };
+
+    constexpr unsigned NumTokenKinds = Token::KW_loopc + 1;
+
+    struct OperatorTable
+    {
+        OperatorInfo Info[NumTokenKinds];
+    };
+
+    constexpr OperatorTable buildOperatorTable()
+    {
+        OperatorTable T{};
+        T.Info[Token::KW_and] = {Prec_Logical, Conditions::And};
+        T.Info[Token::KW_or] = {Prec_Logical, Conditions::Or};
+        T.Info[Token::equal_equal] = {Prec_Compare, Condition::EqualEqual};
+        T.Info[Token::nq] = {Prec_Compare, Condition::NotEqual};
+        T.Info[Token::ls] = {Prec_Compare, Condition::LessThan};
+        T.Info[Token::gr] = {Prec_Compare, Condition::GreaterThan};
+        T.Info[Token::le] = {Prec_Compare, Condition::LessEqual};
+        T.Info[Token::ge] = {Prec_Compare, Condition::GreaterEqual};
+        T.Info[Token::plus] = {Prec_Additive, Expr::Plus};
+        T.Info[Token::minus] = {Prec_Additive, Expr::Minus};
+        T.Info[Token::star] = {Prec_Multiplicative, Expr::Mul};
+        T.Info[Token::slash] = {Prec_Multiplicative, Expr::Div};
+        T.Info[Token::mod] = {Prec_Multiplicative, Expr::Mod};
+        T.Info[Token::hat] = {Prec_Power, Expr::Pow};
+        return T;
+    }
+
+    constexpr OperatorTable Operators = buildOperatorTable();
+
+    inline OperatorInfo lookup(Token::TokenKind Kind)
+    {
+        return Operators.Info[Kind];
+    }
 }
 
-AST *Parser::parseARK()
+
+// main point is that the whole input has been consumed
+template <typename BuilderT>
+typename BuilderT::Result BasicParser<BuilderT>::parse()
 {
-    llvm::SmallVector<Statement *> statements;
+    if (parseARK())
+        return typename BuilderT::Result();
+    return Builder.finish();
+}
 
+template <typename BuilderT>
+bool BasicParser<BuilderT>::parseARK()
+{
     while (!Tok.is(Token::eoi))
     {
         switch (Tok.getKind())
         {
             case Token::KW_int:
-            {
-                Declare *d;
-                d = parseDec();
-                if (d)
-                    statements.push_back(d);
-                else
+                if (parseDec())
                     goto _error2;
                 break;
-            }
             case Token::ident: 
-            {
-                Assign *a;
-                a = parseAssign();
-                if (a)
-                    statements.push_back(a);
-                else
+                if (parseAssign())
                     goto _error2;
                 break;
-            } 
             case Token::KW_if:
-            {
-                If *i;
-                i = parseIf();
-                if (i)
-                    statements.push_back(i);
-                else
+                if (parseIf())
                     goto _error2;
                 break;
-            }
             case Token::KW_loopc:
-            {
-                Loop *a;
-                a = parseLoop();
-                if (a)
-                    statements.push_back(a);
-                else
+                if (parseLoop())
                     goto _error2;
                 break;
-            }
             default:
                 llvm::errs() << "Here: " << Tok.getText() << "\n";
                 goto _error2;
                 break;
         }
     }
-    return new ARK(statements);
+    return false;
 _error2:
     llvm::errs() << "ARK Error at: " << Tok.getText() << "\n";
+    HasError = true;
     while (Tok.getKind() != Token::eoi) 
         advance();
-    return nullptr;
+    return true;
 }
 
-Declare *Parser::parseDec()
+template <typename BuilderT>
+bool BasicParser<BuilderT>::parseDec()
 {
-    int varsCount = 0;
-    int expressionCount = 0;
-    llvm::SmallVector<Expr *> Exprs;
-    llvm::SmallVector<llvm::StringRef, 8> Vars;
+    llvm::SmallVector<unsigned, 8> Symbols;
+    size_t expressionCount = 0;
 
     if (expect(Token::KW_int))
         goto _error;
@@ -82,7 +117,8 @@ Declare *Parser::parseDec()
 
     if (expect(Token::ident))
         goto _error;
-    Vars.push_back(Tok.getText());
+    Symbols.push_back(Context.intern(Tok.getText()));
+    Builder.declareVar(Tok.getText(), Symbols.back());
     advance();
 
     while (Tok.is(Token::comma))
@@ -90,454 +126,368 @@ Declare *Parser::parseDec()
         advance();
         if (expect(Token::ident))
             goto _error;
-        Vars.push_back(Tok.getText());
-        varsCount++;
+        Symbols.push_back(Context.intern(Tok.getText()));
+        Builder.declareVar(Tok.getText(), Symbols.back());
         advance();
     }
 
     if (Tok.is(Token::equal))
     {
-        advance();
-        Expr *E;
-        E = parseExpr();
-        if (E)
-            Exprs.push_back(E);
-        else
-            goto _error;
-        while (Tok.is(Token::comma))
+        do
         {
             advance();
-            E = parseExpr();
-            if (E)
-            {
-                Exprs.push_back(E);
-                if (++expressionCount > varsCount)
-                {
-                    goto _error;
-                }
-            }
-            else
+            if (expressionCount == Symbols.size() || parseExpr())
                 goto _error;
-        }
+            Builder.initVar(Symbols[expressionCount++]);
+        } while (Tok.is(Token::comma));
     }
 
     if (expect(Token::semicolon))
         goto _error;
     advance();
 
-    return new Declare(Vars, Exprs);
+    Builder.endDeclare();
+    return false;
 _error:
     llvm::errs() << "Declration Error at: " << Tok.getText() << "\n";
     while (Tok.getKind() != Token::eoi)
-        
         advance();
-    return nullptr;
+    return true;
 }
 
-Assign *Parser::parseAssign()
+template <typename BuilderT>
+bool BasicParser<BuilderT>::parseAssign()
 {
-    Final *Left;
-    Expr *Right;
-    Assign *Ans;
-    Token::TokenKind tokKind;
+    llvm::StringRef Name;
+    unsigned Symbol;
+    Assign::AssOp Op;
 
     if (expect(Token::ident))
         goto _error;
-    Left = (Final*) parseFinal();
-
-
-    if (!Tok.isOneOf(Token::equal, Token::plus_equal, Token::minus_equal,
-    Token::star_equal, Token::slash_equal, Token::mod_equal))
-        goto _error;
-
-    tokKind = Tok.getKind();
+    Name = Tok.getText();
+    Symbol = Context.intern(Name);
     advance();
 
-    Right = parseExpr();
-
-    if(!Right) goto _error;
-
-    switch (tokKind)
+    switch (Tok.getKind())
     {
     case Token::equal:
-        Ans = new Assign(Left, Assign::AssOp::EqualAssign, Right);
+        Op = Assign::AssOp::EqualAssign;
         break;
     case Token::plus_equal:
-        Ans = new Assign(Left, Assign::AssOp::PlusAssign, Right);
+        Op = Assign::AssOp::PlusAssign;
         break;
     case Token::minus_equal:
-        Ans = new Assign(Left, Assign::AssOp::MinusAssign, Right);
+        Op = Assign::AssOp::MinusAssign;
         break;
     case Token::star_equal:
-        Ans = new Assign(Left, Assign::AssOp::MulAssign, Right);
+        Op = Assign::AssOp::MulAssign;
         break;
     case Token::slash_equal:
-        Ans = new Assign(Left, Assign::AssOp::DivAssign, Right);
+        Op = Assign::AssOp::DivAssign;
         break;
     case Token::mod_equal:
-        Ans = new Assign(Left, Assign::AssOp::ModAssign, Right);
+        Op = Assign::AssOp::ModAssign;
         break;
     default:
         goto _error;
         break;
     }
+    advance();
+
+    if (parseExpr())
+        goto _error;
 
     if (expect(Token::semicolon)) {
         goto _error;
     }
     advance();
 
-    return Ans;
+    Builder.assign(Name, Symbol, Op);
+    return false;
 _error:
     llvm::errs() << "Assignment Error at: " << Tok.getText() << "\n";   
     while (Tok.getKind() != Token::eoi)
         advance();
-    return nullptr;
+    return true;
 }
 
-Expr *Parser::parseExpr()
+template <typename BuilderT>
+bool BasicParser<BuilderT>::parseExpr()
 {
-    Expr *Left;
-    Expr *Right;
-    Token::TokenKind tokKind;
-
-    Left = parseTerm();
-    while (Tok.isOneOf(Token::plus, Token::minus))
+    // pending binary operators; an open parenthesis is an entry with
+    // Prec_None so that no operator is reduced across it. The operands
+    // are kept by the builder.
+    struct PendingOp
     {
-        Expr::Operator Op = Tok.is(Token::plus)
-                                    ? Expr::Plus
-                                    : Expr::Minus;
-        advance();
-        Expr *Right = parseTerm();
-        Left = new Expr(Left, Op,Right);
-    }
-    return Left;
-    
-_error:
-    llvm::errs() << "Expression Error at: " << Tok.getText() << "\n";
-    while (Tok.getKind() != Token::eoi)
-        advance();
-    return nullptr;
+        binop::Precedence Prec;
+        unsigned char Op;
+    };
+    llvm::SmallVector<PendingOp, 16> Operators;
+    unsigned OpenParens = 0;
 
-}
+    auto reduce = [&]()
+    {
+        Builder.binary((Expr::Operator)Operators.pop_back_val().Op);
+    };
 
-Expr *Parser::parseTerm()
-{
-    Expr *Left = parseFactor();
-    while (Tok.isOneOf(Token::star, Token::slash, Token::mod))
+    while (true)
     {
-        Expr::Operator Op = Tok.is(Token::star) ? Expr::Mul : (Tok.is(Token::mod) ? Expr::Mod : Expr::Div);
+        while (Tok.is(Token::l_paren))
+        {
+            Operators.push_back({binop::Prec_None, 0});
+            ++OpenParens;
+            advance();
+        }
+
+        if (parseFinal())
+            return true;
+
+        while (OpenParens && Tok.is(Token::r_paren))
+        {
+            while (Operators.back().Prec != binop::Prec_None)
+                reduce();
+            Operators.pop_back();
+            --OpenParens;
+            advance();
+        }
+
+        binop::OperatorInfo Info = binop::lookup(Tok.getKind());
+        if (Info.Prec < binop::Prec_Additive)
+            break;
+        // every arithmetic operator, '^' included, is left associative
+        while (!Operators.empty() && Operators.back().Prec >= Info.Prec)
+            reduce();
+        Operators.push_back({Info.Prec, Info.Op});
         advance();
-        Expr *Right = parseFactor();
-        Left = new Expr(Left, Op,Right);
     }
-  return Left;
-}
 
-Expr *Parser::parseFactor()
-{
-    Expr *Left = parseFinal();
-    while (Tok.is(Token::hat))
+    if (OpenParens)
     {
-        advance();
-        Expr *Right = parseFinal();
-        Left = new Expr(Left, Expr::Pow, Right);
+        expect(Token::r_paren);
+        goto _error;
     }
-  return Left;
-}
+    while (!Operators.empty())
+        reduce();
+    return false;
 
+_error:
+    llvm::errs() << "Expression Error at: " << Tok.getText() << "\n";
+    while (Tok.getKind() != Token::eoi)
+        advance();
+    return true;
+}
 
-Expr *Parser::parseFinal() 
+template <typename BuilderT>
+bool BasicParser<BuilderT>::parseFinal() 
 {
-    Expr *Res;
+    uint64_t Value;
     switch (Tok.getKind())
     {
     case Token::number:
-        Res = new Final(Final::ValueKind::Number, Tok.getText());
+        // values are 32-bit signed integers and literals have no sign
+        if (Tok.getText().getAsInteger(10, Value) || Value > INT32_MAX)
+        {
+            llvm::errs() << "Integer literal " << Tok.getText() << " does not fit in 32 bits\n";
+            HasError = true;
+            goto _error;
+        }
+        Builder.number(Tok.getText(), Value);
         advance();
         break;
     case Token::ident:
-        Res = new Final(Final::ValueKind::Ident, Tok.getText());
+        Builder.ident(Tok.getText(), Context.intern(Tok.getText()));
         advance();
         break;
-    case Token::l_paren:
-        advance();
-        Res = parseExpr();
-        if (!consume(Token::r_paren))
-            break;
     default: // error handling
         llvm::errs() << "Expected ID/Number/Parentheses but got: " << Tok.getText() << "\n";
         goto _error;
         break;
     }
-    return Res;
+    return false;
 _error:
     while (Tok.getKind() != Token::eoi)
         advance();
-    return nullptr;
+    return true;
 }
 
-Conditions *Parser::parseConditions()
+template <typename BuilderT>
+bool BasicParser<BuilderT>::parseConditions()
 {
-    Condition *Left = nullptr;
-    Conditions *Right = nullptr;
-    Token::TokenKind tokKind;
-
-    Left = parseCondition();
+    llvm::SmallVector<Conditions::Operator, 8> Signs;
 
-    if(!Left) goto _error;
-
-    if (!Tok.isOneOf(Token::KW_and, Token::KW_or))
+    while (true)
     {
-        return (Conditions*) Left;
-    }
-
-    tokKind = Tok.getKind();
-    advance();
-
-    Right = parseConditions();
-
-    if (!Right) goto _error;
-    
-    switch (tokKind)
-    {
-        case Token::KW_and:
-            return new Conditions(Left, Conditions::Operator::And, Right);
-        case Token::KW_or:
-            return new Conditions(Left, Conditions::Operator::Or, Right);
-        default:
-        {
+        if (parseCondition())
             goto _error;
+
+        binop::OperatorInfo Info = binop::lookup(Tok.getKind());
+        if (Info.Prec != binop::Prec_Logical)
             break;
-        }
+        Signs.push_back((Conditions::Operator)Info.Op);
+        advance();
     }
+
+    // "and" and "or" share one level and chain to the right, so join the
+    // chain from its last condition
+    while (!Signs.empty())
+        Builder.logical(Signs.pop_back_val());
+    return false;
+
 _error:
     llvm::errs() << "ConditionS Error at: " << Tok.getText() << "\n";
     while (Tok.getKind() != Token::eoi)
         advance();
-    return nullptr;
+    return true;
 }
 
-Condition *Parser::parseCondition()
+template <typename BuilderT>
+bool BasicParser<BuilderT>::parseCondition()
 {
-    Expr *Left = nullptr;
-    Expr *Right = nullptr;
-
-    Left = parseExpr();
+    binop::OperatorInfo Info;
 
-    if(!Left)
+    if (parseExpr())
         goto _error;
 
-    Condition::Operator Op;
-    switch (Tok.getKind())
-    {
-    case Token::equal_equal:
-        Op = Condition::Operator::EqualEqual;
-        break;
-    case Token::nq:
-        Op = Condition::Operator::NotEqual;
-        break;
-    case Token::ls:
-        Op = Condition::Operator::LessThan;
-        break;
-    case Token::gr:
-        Op = Condition::Operator::GreaterThan;
-        break;
-    case Token::le:
-        Op = Condition::Operator::LessEqual;
-        break;
-    case Token::ge:
-        Op = Condition::Operator::GreaterEqual;
-        break;
-    default:
+    Info = binop::lookup(Tok.getKind());
+    if (Info.Prec != binop::Prec_Compare)
         goto _error;
-        return nullptr;
-    }
 
     advance();
 
-    Right = parseExpr();
-
-    if(!Right)
+    if (parseExpr())
         goto _error;
 
-    return new Condition(Left, Op, Right);
+    Builder.compare((Condition::Operator)Info.Op);
+    return false;
 _error:
     llvm::errs() << "Condition Error at: " << Tok.getText() << "\n";
     while (Tok.getKind() != Token::eoi)
         advance();
-    return nullptr;
+    return true;
 }
 
-If *Parser::parseIf()
+// ": begin" assignments "end", the body of an arm or a loop
+template <typename BuilderT>
+bool BasicParser<BuilderT>::parseBody()
 {
-    Conditions *Cond;
-    llvm::SmallVector<Assign *> Assigns;
-    llvm::SmallVector<Elif *> Elifs;
-    Else *ElseBranch = nullptr;
-
-    if (expect(Token::KW_if))
-        goto _error;
-    advance();
-
-    Cond = parseConditions();
-    if(!Cond)
-        goto _error;
-
     if (expect(Token::colon))
-        goto _error;
+        return true;
     advance();
 
     if (expect(Token::KW_begin))
-        goto _error;
+        return true;
     advance();
 
     while (!Tok.is(Token::KW_end))
     {
-        Assign *a;
-        a = parseAssign();
-        if (a)
-            Assigns.push_back(a);
-        else
-            goto _error;
+        if (parseAssign())
+            return true;
     }
     advance();
 
+    Builder.endBody();
+    return false;
+}
+
+template <typename BuilderT>
+bool BasicParser<BuilderT>::parseIf()
+{
+    if (expect(Token::KW_if))
+        goto _error;
+    advance();
+
+    if (parseConditions())
+        goto _error;
+
+    Builder.beginIf();
+    if (parseBody())
+        goto _error;
+
     while (Tok.is(Token::KW_elif))
     {
-        Elif *Elif;
-        Elif = parseElif();
-        if (Elif)
-            Elifs.push_back(Elif);
-        else
+        if (parseElif())
             goto _error;
     }
 
     if (Tok.is(Token::KW_else))
     {
-        ElseBranch = parseElse();
-        if(!ElseBranch)
+        if (parseElse())
             goto _error;
     }
 
-    return new If(Cond, Assigns, Elifs, ElseBranch);
+    Builder.endIf();
+    return false;
 
 _error:
     llvm::errs() << "If Error at: " << Tok.getText() << "\n";
     while (Tok.getKind() != Token::eoi)
         advance();
-    return nullptr;
+    return true;
 }
 
-Elif *Parser::parseElif()
+template <typename BuilderT>
+bool BasicParser<BuilderT>::parseElif()
 {
-    Conditions *Cond;
-    llvm::SmallVector<Assign *> Assigns;
-
     if (expect(Token::KW_elif))
         goto _error;
     advance();
 
-    Cond = parseConditions();
-    if(!Cond)
+    if (parseConditions())
         goto _error;
 
-    if (expect(Token::colon))
-        goto _error;
-    advance();
-
-    if (expect(Token::KW_begin))
+    Builder.beginElif();
+    if (parseBody())
         goto _error;
-    advance();
 
-    while (!Tok.is(Token::KW_end))
-    {
-        Assign *a;
-        a = parseAssign();
-        if (a)
-            Assigns.push_back(a);
-        else
-            goto _error;
-    }
-    advance();
-
-    return new Elif(Cond, Assigns);
+    return false;
 _error:
     llvm::errs() << "Elif Error at: " << Tok.getText() << "\n";
     while (Tok.getKind() != Token::eoi)
         advance();
-    return nullptr;
+    return true;
 }
 
-Else *Parser::parseElse()
+template <typename BuilderT>
+bool BasicParser<BuilderT>::parseElse()
 {
-    llvm::SmallVector<Assign *> Assigns;
-
     if (expect(Token::KW_else))
         goto _error;
     advance();
 
-    if (expect(Token::colon))
+    Builder.beginElse();
+    if (parseBody())
         goto _error;
-    advance();
-
-    if (expect(Token::KW_begin))
-        goto _error;
-    advance();
 
-    while (!Tok.is(Token::KW_end))
-    {
-        Assign *a;
-        a = parseAssign();
-        if (a)
-            Assigns.push_back(a);
-        else
-            goto _error;
-    }
-    advance();
-
-    return new Else(Assigns);
+    return false;
 _error:
     llvm::errs() << "Else Error at: " << Tok.getText() << "\n";
     while (Tok.getKind() != Token::eoi)
         advance();
-    return nullptr;
+    return true;
 }
 
-Loop *Parser::parseLoop()
+template <typename BuilderT>
+bool BasicParser<BuilderT>::parseLoop()
 {
-    Conditions *Cond;
-    llvm::SmallVector<Assign *> Assigns;
-
     if (expect(Token::KW_loopc))
         goto _error;
     advance();
 
-    Cond = parseConditions();
-    if (expect(Token::colon))
+    if (parseConditions())
         goto _error;
-    advance();
 
-    if (expect(Token::KW_begin))
+    Builder.beginLoop();
+    if (parseBody())
         goto _error;
-    advance();
 
-    while (!Tok.is(Token::KW_end))
-    {
-        Assign *a;
-        a = parseAssign();
-        if (a)
-            Assigns.push_back(a);
-        else
-            goto _error;
-    }
-    advance();
-
-    return new Loop(Cond, Assigns);
+    return false;
 
 _error:
     llvm::errs() << "Loopc Error at: " << Tok.getText() << "\n";
     while (Tok.getKind() != Token::eoi)
         advance();
-    return nullptr;
+    return true;
 }
+
+template class BasicParser<TreeBuilder>;
+template class BasicParser<FlatBuilder>;
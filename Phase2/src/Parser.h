@@ -2,12 +2,202 @@
 #define PARSER_H
 
 #include "AST.h"
+#include "FlatAST.h"
 #include "Lexer.h"
+#include "llvm/ADT/Optional.h"
 #include "llvm/Support/raw_ostream.h"
 
-class Parser
+// The parser reports every node to a builder once its operands have been
+// reported, i.e. expressions in post-order and statements in program order.
+// TreeBuilder turns that into the pointer tree and FlatBuilder appends it to
+// a FlatAST, so either form is built in the one pass over the tokens.
+
+// Builds the pointer tree in the ASTContext arena, keeping the operands not
+// yet used by a node on stacks.
+class TreeBuilder
+{
+    ASTContext &Context;
+    llvm::SmallVector<Expr *, 16> Values;
+    llvm::SmallVector<Conditions *, 8> Conds;
+    llvm::SmallVector<Statement *> Statements;
+
+    // the declaration being parsed
+    llvm::SmallVector<llvm::StringRef, 8> Vars;
+    llvm::SmallVector<Expr *> Inits;
+
+    // the if statement or loop being parsed and its current arm
+    enum ArmKind { IfArm, ElifArm, ElseArm, LoopArm };
+    ArmKind Arm;
+    Conditions *ArmConds = nullptr;
+    llvm::SmallVector<Assign *> Body;
+    bool InBody = false;
+    Conditions *IfConds = nullptr;
+    llvm::SmallVector<Assign *> IfAssigns;
+    llvm::SmallVector<Elif *> Elifs;
+    Else *ElseBranch = nullptr;
+
+    void beginArm(ArmKind Kind)
+    {
+        Arm = Kind;
+        ArmConds = Kind == ElseArm ? nullptr : Conds.pop_back_val();
+        Body.clear();
+        InBody = true;
+    }
+
+public:
+    using Result = AST *;
+
+    TreeBuilder(ASTContext &Context) : Context(Context) {}
+
+    void number(llvm::StringRef Text, int64_t Value) { Values.push_back(new (Context) Final(Text, Value)); }
+
+    void ident(llvm::StringRef Name, unsigned Symbol)
+    {
+        Values.push_back(new (Context) Final(Final::Ident, Name, Symbol));
+    }
+
+    void binary(Expr::Operator Op)
+    {
+        Expr *Right = Values.pop_back_val();
+        Expr *Left = Values.pop_back_val();
+        Values.push_back(new (Context) Expr(Left, Op, Right));
+    }
+
+    void compare(Condition::Operator Op)
+    {
+        Expr *Right = Values.pop_back_val();
+        Expr *Left = Values.pop_back_val();
+        Conds.push_back(new (Context) Condition(Left, Op, Right));
+    }
+
+    void logical(Conditions::Operator Op)
+    {
+        Conditions *Right = Conds.pop_back_val();
+        Condition *Left = llvm::cast<Condition>(Conds.pop_back_val());
+        Conds.push_back(new (Context) Conditions(Left, Op, Right));
+    }
+
+    void declareVar(llvm::StringRef Name, unsigned Symbol) { Vars.push_back(Name); }
+
+    void initVar(unsigned Symbol) { Inits.push_back(Values.pop_back_val()); }
+
+    void endDeclare()
+    {
+        Statements.push_back(new (Context) Declare(Context, Vars, Inits));
+        Vars.clear();
+        Inits.clear();
+    }
+
+    void assign(llvm::StringRef Name, unsigned Symbol, Assign::AssOp Op)
+    {
+        Final *Left = new (Context) Final(Final::Ident, Name, Symbol);
+        Assign *A = new (Context) Assign(Left, Op, Values.pop_back_val());
+        if (InBody)
+            Body.push_back(A);
+        else
+            Statements.push_back(A);
+    }
+
+    void beginIf() { beginArm(IfArm); }
+    void beginElif() { beginArm(ElifArm); }
+    void beginElse() { beginArm(ElseArm); }
+    void beginLoop() { beginArm(LoopArm); }
+
+    void endBody()
+    {
+        InBody = false;
+        switch (Arm)
+        {
+        case IfArm:
+            IfConds = ArmConds;
+            IfAssigns.assign(Body.begin(), Body.end());
+            Elifs.clear();
+            ElseBranch = nullptr;
+            break;
+        case ElifArm:
+            Elifs.push_back(new (Context) Elif(Context, ArmConds, Body));
+            break;
+        case ElseArm:
+            ElseBranch = new (Context) Else(Context, Body);
+            break;
+        case LoopArm:
+            Statements.push_back(new (Context) Loop(Context, ArmConds, Body));
+            break;
+        }
+    }
+
+    void endIf() { Statements.push_back(new (Context) If(Context, IfConds, IfAssigns, Elifs, ElseBranch)); }
+
+    Result finish() { return new (Context) ARK(Context, Statements); }
+};
+
+// Appends the nodes to a FlatAST in the order they are reported; only the
+// indices of operands not yet used by a node are kept on a stack.
+class FlatBuilder
+{
+    FlatAST Flat;
+    llvm::SmallVector<uint32_t, 16> Operands;
+    uint32_t IfBranch = FlatAST::None; // branch of the if statement being parsed
+    uint32_t Arm = FlatAST::None;      // branch whose body is being parsed
+
+    uint32_t pop() { return Operands.pop_back_val(); }
+
+    void push(FlatAST::NodeKind Kind, uint8_t Op, uint32_t Left, uint32_t Right)
+    {
+        Operands.push_back(Flat.addNode(Kind, Op, Left, Right));
+    }
+
+    void join(FlatAST::NodeKind Kind, uint8_t Op)
+    {
+        uint32_t Right = pop();
+        uint32_t Left = pop();
+        push(Kind, Op, Left, Right);
+    }
+
+public:
+    using Result = llvm::Optional<FlatAST>;
+
+    FlatBuilder(ASTContext &Context) {}
+
+    void number(llvm::StringRef Text, int64_t Value) { push(FlatAST::Number, 0, Value, FlatAST::None); }
+    void ident(llvm::StringRef Name, unsigned Symbol) { push(FlatAST::Ident, 0, Symbol, FlatAST::None); }
+    void binary(Expr::Operator Op) { join(FlatAST::Binary, Op); }
+    void compare(Condition::Operator Op) { join(FlatAST::Compare, Op); }
+    void logical(Conditions::Operator Op) { join(FlatAST::Logical, Op); }
+
+    void declareVar(llvm::StringRef Name, unsigned Symbol) { Flat.addNode(FlatAST::DeclVar, 0, Symbol, FlatAST::None); }
+    void initVar(unsigned Symbol) { Flat.addNode(FlatAST::Init, 0, Symbol, pop()); }
+    void endDeclare() {}
+
+    void assign(llvm::StringRef Name, unsigned Symbol, Assign::AssOp Op)
+    {
+        Flat.addNode(FlatAST::Store, Op, Symbol, pop());
+    }
+
+    // the end of each body is filled in by endBody, and that of the whole
+    // if statement by endIf
+    void beginIf() { IfBranch = Arm = Flat.addNode(FlatAST::IfBranch, 0, pop(), FlatAST::None); }
+    void beginElif() { Arm = Flat.addNode(FlatAST::ElifBranch, 0, pop(), FlatAST::None); }
+    void beginElse() { Arm = Flat.addNode(FlatAST::ElseBranch, 0, FlatAST::None, FlatAST::None); }
+    void beginLoop() { Arm = Flat.addNode(FlatAST::LoopBody, 0, pop(), FlatAST::None); }
+
+    void endBody()
+    {
+        if (Arm != IfBranch)
+            Flat.RHS[Arm] = Flat.size();
+    }
+
+    void endIf() { Flat.RHS[IfBranch] = Flat.size(); }
+
+    Result finish() { return std::move(Flat); }
+};
+
+template <typename BuilderT>
+class BasicParser
 {
     Lexer &Lex;    // retrieve the next token from the input
+    ASTContext &Context; // interns the identifiers
+    BuilderT Builder; // builds the parsed program
     Token Tok;     // stores the next token
     bool HasError; // indicates if an error was detected
 
@@ -40,23 +230,24 @@ class Parser
         return false;
     }
 
-    AST *parseARK();
-    Declare *parseDec();
-    Assign *parseAssign();
-    Expr *parseExpr();
-    Expr *parseTerm();
-    Expr *parseFactor();
-    Expr *parseFinal();
-    Conditions *parseConditions();
-    Condition *parseCondition();
-    If *parseIf();
-    Elif *parseElif();
-    Else *parseElse();
-    Loop *parseLoop();
+    // each returns true if there was an error, after skipping to the end
+    // of the input
+    bool parseARK();
+    bool parseDec();
+    bool parseAssign();
+    bool parseExpr();
+    bool parseFinal();
+    bool parseConditions();
+    bool parseCondition();
+    bool parseIf();
+    bool parseElif();
+    bool parseElse();
+    bool parseLoop();
+    bool parseBody();
 
 public:
     // initializes all members and retrieves the first token
-    Parser(Lexer &Lex) : Lex(Lex), HasError(false)
+    BasicParser(Lexer &Lex, ASTContext &Context) : Lex(Lex), Context(Context), Builder(Context), HasError(false)
     {
         advance();
     }
@@ -64,7 +255,13 @@ public:
     // get the value of error flag
     bool hasError() { return HasError; }
 
-    AST *parse();
+    // the program, or null (None) after a syntax error
+    typename BuilderT::Result parse();
 };
 
-#endif
\ No newline at end of file
+// parses into the pointer tree
+using Parser = BasicParser<TreeBuilder>;
+// parses into the flat form, without building the tree
+using FlatParser = BasicParser<FlatBuilder>;
+
+#endif
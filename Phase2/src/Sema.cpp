@@ -1,11 +1,11 @@
 #include "Sema.h"
-#include "llvm/ADT/StringSet.h"
+#include "llvm/ADT/BitVector.h"
 #include "llvm/Support/raw_ostream.h"
 
 namespace {
 
-class InputCheck : public ASTVisitor {
-  llvm::StringSet<> Scope; // StringSet to store declared variables
+class InputCheck : public StaticASTVisitor<InputCheck> {
+  llvm::BitVector Scope; // declared variables, indexed by symbol ID
   bool HasError; // Flag to indicate if an error occurred
 
   enum ErrorType { Twice, Not }; // Enum to represent error types: Twice - variable declared twice, Not - variable not declared
@@ -24,159 +24,221 @@ class InputCheck : public ASTVisitor {
 
 
 public:
-  InputCheck() : HasError(false) {} // Constructor
+  using StaticASTVisitor<InputCheck>::visit;
+
+  InputCheck(ASTContext &Context) : Scope(Context.getNumSymbols()), HasError(false) {} // Constructor
 
   bool hasError() { return HasError; } // Function to check if an error occurred
 
   // Visit function for GSM nodes
-  virtual void visit(ARK &Node) override {
-    for (llvm::SmallVector<Statement *>::const_iterator I = Node.begin(), E = Node.end(); I != E; ++I)
+  void visit(ARK &Node) {
+    for (llvm::ArrayRef<Statement *>::const_iterator I = Node.begin(), E = Node.end(); I != E; ++I)
     {
-      (*I)->accept(*this); // Visit each child node
+      dispatch((*I)); // Visit each child node
     }
   };
 
-  virtual void visit(Statement &Node) override {};
-
-  virtual void visit(Declare &Node) override {
-    for (llvm::SmallVector<llvm::StringRef, 8>::const_iterator I = Node.VarsBegin(), E = Node.VarsEnd(); I != E; ++I) {
-      if (!Scope.insert(*I).second)
-        declare_error(Twice, *I); // If the insertion fails (element already exists in Scope), report a "Twice" error
+  void visit(Declare &Node) {
+    llvm::ArrayRef<unsigned> Symbols = Node.getSymbols();
+    for (size_t I = 0, E = Symbols.size(); I != E; ++I) {
+      if (Scope.test(Symbols[I]))
+        declare_error(Twice, Node.getVars()[I]); // If the variable is already in Scope, report a "Twice" error
+      Scope.set(Symbols[I]);
     }
-    for (llvm::SmallVector<Expr *>::const_iterator I = Node.ExprsBegin(), E = Node.ExprsEnd(); I != E; ++I) {
-        (*I)->accept(*this);
+    for (llvm::ArrayRef<Expr *>::const_iterator I = Node.ExprsBegin(), E = Node.ExprsEnd(); I != E; ++I) {
+        dispatch((*I));
     }
   };
 
 
-  virtual void visit(Assign &Node) override {
+  void visit(Assign &Node) {
     Final *left = Node.getLeft();
     Expr *right = Node.getRight();
 
-    left->accept(*this);
+    dispatch(left);
 
-    right->accept(*this);
+    dispatch(right);
 
     if (Node.getAssignmentOP() == Assign::DivAssign || Node.getAssignmentOP() == Assign::ModAssign) {
-      Final * f = (Final *)right;
-      if (f->getKind() == Final::Number) {
-        int intval;
-        f->getVal().getAsInteger(10, intval);
-
-        if (intval == 0) divide_by_zero_error();
-      }
+      Final *f = llvm::dyn_cast<Final>(right);
+      if (f && f->getKind() == Final::Number && f->getValue() == 0)
+        divide_by_zero_error();
     }
   };
 
 
-  virtual void visit(Expr &Node) override {
+  void visit(Expr &Node) {
     Expr *left = Node.getLeft();
     Expr *right = Node.getRight();
 
-    left->accept(*this);
+    dispatch(left);
 
     if (right) {
-      right->accept(*this);
+      dispatch(right);
 
       if (Node.getOperator() == Expr::Div || Node.getOperator() == Expr::Mod && right) {
-        Final * f = (Final *)right;
-
-        if (right && f->getKind() == Final::Number) {
-          int intval;
-          f->getVal().getAsInteger(10, intval);
+        Final *f = llvm::dyn_cast<Final>(right);
 
-          if (intval == 0) divide_by_zero_error();
-        }
+        if (f && f->getKind() == Final::Number && f->getValue() == 0)
+          divide_by_zero_error();
       }
     }
   };
 
 
-  virtual void visit(Conditions &Node) override {
-    Condition *left = Node.getLeft();
-
-    Conditions *right = Node.getRight();
-
-    left->accept(*this);
-
-    if(right) right->accept(*this);
-
+  void visit(Conditions &Node) {
+    // walk the right-leaning and/or chain in a loop, it can be thousands
+    // of conditions long
+    Conditions *conds = &Node;
+    while (conds && !llvm::isa<Condition>(conds)) {
+      dispatch(conds->getLeft());
+      conds = conds->getRight();
+    }
+    if (conds) dispatch(conds);
   };
 
 
-  virtual void visit(Condition &Node) override {
+  void visit(Condition &Node) {
     Expr *left = Node.getLeft();
     Expr *right = Node.getRight();
 
-    left->accept(*this);
-    right->accept(*this);
+    dispatch(left);
+    dispatch(right);
   };
 
 
-  virtual void visit(Final &Node) override {
+  void visit(Final &Node) {
     if (Node.getKind() == Final::Ident) {
       // Check if identifier is in the scope
-      if (Scope.find(Node.getVal()) == Scope.end())
+      if (!Scope.test(Node.getSymbol()))
         declare_error(Not, Node.getVal()); // Variable Not Found
     }
   };
 
 
-  virtual void visit(If &Node) override {
+  void visit(If &Node) {
     Conditions *conds = Node.getConds();
     Else *ElseBranch = Node.getElse();
 
-    conds->accept(*this);
+    dispatch(conds);
 
-    for (llvm::SmallVector<Assign *>::const_iterator I = Node.AssignmentsBegin(), E = Node.AssignmentsEnd(); I != E; ++I) {
-        (*I)->accept(*this);
+    for (llvm::ArrayRef<Assign *>::const_iterator I = Node.AssignmentsBegin(), E = Node.AssignmentsEnd(); I != E; ++I) {
+        dispatch((*I));
     }
     
-    for (llvm::SmallVector<Elif *>::const_iterator I = Node.ElifsBegin(), E = Node.ElifsEnd(); I != E; ++I) {
-        (*I)->accept(*this);
+    for (llvm::ArrayRef<Elif *>::const_iterator I = Node.ElifsBegin(), E = Node.ElifsEnd(); I != E; ++I) {
+        dispatch((*I));
     }
 
-    if(ElseBranch) ElseBranch->accept(*this);
+    if(ElseBranch) dispatch(ElseBranch);
 
   };
 
 
-  virtual void visit(Elif &Node) override {
+  void visit(Elif &Node) {
     Conditions *conds = Node.getConds();
 
-    conds->accept(*this);
+    dispatch(conds);
 
-    for (llvm::SmallVector<Assign *>::const_iterator I = Node.AssignmentsBegin(), E = Node.AssignmentsEnd(); I != E; ++I) {
-        (*I)->accept(*this);
+    for (llvm::ArrayRef<Assign *>::const_iterator I = Node.AssignmentsBegin(), E = Node.AssignmentsEnd(); I != E; ++I) {
+        dispatch((*I));
     }
   };
 
 
-  virtual void visit(Else &Node) override {
-    for (llvm::SmallVector<Assign *>::const_iterator I = Node.AssignmentsBegin(), E = Node.AssignmentsEnd(); I != E; ++I) {
-        (*I)->accept(*this);
+  void visit(Else &Node) {
+    for (llvm::ArrayRef<Assign *>::const_iterator I = Node.AssignmentsBegin(), E = Node.AssignmentsEnd(); I != E; ++I) {
+        dispatch((*I));
     }
   };
 
 
-  virtual void visit(Loop &Node) override {
+  void visit(Loop &Node) {
     Conditions *conds = Node.getConds();
 
-    conds->accept(*this);
+    dispatch(conds);
 
-    for (llvm::SmallVector<Assign *>::const_iterator I = Node.AssignmentsBegin(), E = Node.AssignmentsEnd(); I != E; ++I) {
-        (*I)->accept(*this);
+    for (llvm::ArrayRef<Assign *>::const_iterator I = Node.AssignmentsBegin(), E = Node.AssignmentsEnd(); I != E; ++I) {
+        dispatch((*I));
     }
   };
 };
 }
 
-bool Sema::semantic(AST *Tree) {
+namespace {
+
+// The same checks as InputCheck, as one forward scan over a FlatAST.
+class FlatInputCheck {
+  const FlatAST &Tree;
+  ASTContext &Context;
+  llvm::BitVector Scope; // declared variables, indexed by symbol ID
+  bool HasError; // Flag to indicate if an error occurred
+
+  enum ErrorType { Twice, Not };
+
+  void declare_error(ErrorType ET, llvm::StringRef V) {
+    llvm::errs() << "Variable " << V << " is "
+                 << (ET == Twice ? "already" : "not")
+                 << " declared\n";
+    HasError = true;
+  }
+
+  void divide_by_zero_error() {
+    llvm::errs() << "Division/Modulo by zero is not allowed." << "\n";
+    HasError = true;
+  }
+
+  void check_divisor(uint32_t Divisor) {
+    if (Tree.Kinds[Divisor] == FlatAST::Number && Tree.LHS[Divisor] == 0)
+      divide_by_zero_error();
+  }
+
+public:
+  FlatInputCheck(const FlatAST &Tree, ASTContext &Context)
+      : Tree(Tree), Context(Context), Scope(Context.getNumSymbols()), HasError(false) {}
+
+  bool run() {
+    for (uint32_t I = 0, E = Tree.size(); I != E; ++I) {
+      switch (Tree.Kinds[I]) {
+      case FlatAST::DeclVar:
+        if (Scope.test(Tree.LHS[I]))
+          declare_error(Twice, Context.getSymbolName(Tree.LHS[I]));
+        Scope.set(Tree.LHS[I]);
+        break;
+      case FlatAST::Ident:
+        if (!Scope.test(Tree.LHS[I]))
+          declare_error(Not, Context.getSymbolName(Tree.LHS[I]));
+        break;
+      case FlatAST::Store:
+        if (!Scope.test(Tree.LHS[I]))
+          declare_error(Not, Context.getSymbolName(Tree.LHS[I]));
+        if (Tree.Ops[I] == Assign::DivAssign || Tree.Ops[I] == Assign::ModAssign)
+          check_divisor(Tree.RHS[I]);
+        break;
+      case FlatAST::Binary:
+        if (Tree.Ops[I] == Expr::Div || Tree.Ops[I] == Expr::Mod)
+          check_divisor(Tree.RHS[I]);
+        break;
+      default:
+        break;
+      }
+    }
+    return HasError;
+  }
+};
+}
+
+bool Sema::semantic(const FlatAST &Tree, ASTContext &Context) {
+  FlatInputCheck Check(Tree, Context);
+  return Check.run();
+}
+
+bool Sema::semantic(AST *Tree, ASTContext &Context) {
   if (!Tree)
     return false; // If the input AST is not valid, return false indicating no errors
 
-  InputCheck Check; // Create an instance of the InputCheck class for semantic analysis
-  Tree->accept(Check); // Initiate the semantic analysis by traversing the AST using the accept function
+  InputCheck Check(Context); // Create an instance of the InputCheck class for semantic analysis
+  Check.dispatch(Tree); // Initiate the semantic analysis by traversing the AST using the visitor
 
   return Check.hasError(); // Return the result of Check.hasError() indicating if any errors were detected during the analysis
 }
\ No newline at end of file
@@ -2,11 +2,13 @@
 #define SEMA_H
 
 #include "AST.h"
+#include "FlatAST.h"
 #include "Lexer.h"
 
 class Sema {
 public:
-  bool semantic(AST *Tree);
+  bool semantic(AST *Tree, ASTContext &Context);
+  bool semantic(const FlatAST &Tree, ASTContext &Context);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,52 @@
+// Parses each program named on the command line twice, into the pointer
+// tree and straight into the flat form, and fails unless the parser builds
+// the same flat form that FlatAST::fromTree converts the tree to.
+
+#include "FlatAST.h"
+#include "Parser.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include <cstdio>
+
+int main(int argc, char **argv)
+{
+    bool Passed = true;
+    for (int I = 1; I < argc; ++I)
+    {
+        llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> Buffer = llvm::MemoryBuffer::getFile(argv[I]);
+        if (!Buffer)
+        {
+            std::fprintf(stderr, "cannot read %s\n", argv[I]);
+            return 1;
+        }
+        llvm::StringRef Source = (*Buffer)->getBuffer();
+
+        ASTContext TreeContext;
+        Lexer TreeLex(Source);
+        Parser TreeParser(TreeLex, TreeContext);
+        AST *Tree = TreeParser.parse();
+
+        ASTContext FlatContext;
+        Lexer FlatLex(Source);
+        FlatParser DirectParser(FlatLex, FlatContext);
+        llvm::Optional<FlatAST> Flat = DirectParser.parse();
+
+        if (!Tree || TreeParser.hasError() || !Flat || DirectParser.hasError())
+        {
+            std::fprintf(stderr, "%s did not parse\n", argv[I]);
+            Passed = false;
+            continue;
+        }
+
+        // both parsers intern the names in the same order, so the symbol
+        // IDs in the nodes must match too
+        FlatAST Converted = FlatAST::fromTree(Tree);
+        if (Converted.Kinds != Flat->Kinds || Converted.Ops != Flat->Ops ||
+            Converted.LHS != Flat->LHS || Converted.RHS != Flat->RHS ||
+            TreeContext.getNumSymbols() != FlatContext.getNumSymbols())
+        {
+            std::fprintf(stderr, "%s: the parser's flat form differs from the converted tree\n", argv[I]);
+            Passed = false;
+        }
+    }
+    return Passed ? 0 : 1;
+}
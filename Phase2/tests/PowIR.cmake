@@ -0,0 +1,27 @@
+# Checks how ^ is lowered in programs/pow_ir.ARK, before optimization:
+# square-and-multiply for a constant exponent, a call to ark_ipow for a
+# variable one.
+
+execute_process(COMMAND ${ARK} ${SOURCE}
+                OUTPUT_VARIABLE Modules
+                ERROR_VARIABLE Log
+                RESULT_VARIABLE Result)
+if(NOT Result EQUAL 0)
+  message(FATAL_ERROR "ARK failed on ${SOURCE}:\n${Log}")
+endif()
+string(FIND "${Modules}" "; ModuleID" After REVERSE)
+string(SUBSTRING "${Modules}" 0 ${After} Before)
+
+# x ^ 1000 takes 9 squares and 5 multiplies, x ^ 1000000 19 squares and
+# 6 multiplies, instead of 999 and 999999 chained multiplies.
+string(REGEX MATCHALL "= mul nsw " Muls "${Before}")
+list(LENGTH Muls NumMuls)
+if(NOT NumMuls EQUAL 39)
+  message(FATAL_ERROR "expected 39 multiplies for x ^ 1000 and x ^ 1000000, got ${NumMuls}:\n${Before}")
+endif()
+
+string(REGEX MATCHALL "call i32 @ark_ipow\\(" Calls "${Before}")
+list(LENGTH Calls NumCalls)
+if(NOT NumCalls EQUAL 1)
+  message(FATAL_ERROR "expected one call to ark_ipow for x ^ e, got ${NumCalls}:\n${Before}")
+endif()
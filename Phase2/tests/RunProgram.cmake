@@ -0,0 +1,46 @@
+# Runs one ARK program test, see add_ark_program_test in CMakeLists.txt.
+
+string(REPLACE "|" ";" ARK_FLAGS "${ARK_FLAGS}")
+execute_process(COMMAND ${ARK} ${SOURCE} ${ARK_FLAGS}
+                OUTPUT_VARIABLE Modules
+                ERROR_VARIABLE Log
+                RESULT_VARIABLE Result)
+if(NOT Result EQUAL 0)
+  message(FATAL_ERROR "ARK failed on ${SOURCE}:\n${Log}")
+endif()
+
+# The driver prints the module before optimization, then the one after.
+string(FIND "${Modules}" "; ModuleID" After REVERSE)
+if(After LESS_EQUAL 0)
+  message(FATAL_ERROR "expected two modules from ARK, got:\n${Modules}")
+endif()
+string(SUBSTRING "${Modules}" 0 ${After} Before)
+string(SUBSTRING "${Modules}" ${After} -1 Optimized)
+
+if(NOT HANGS)
+  file(READ ${EXPECTED} Expected)
+endif()
+file(MAKE_DIRECTORY ${WORK_DIR})
+foreach(Stage Before Optimized)
+  file(WRITE ${WORK_DIR}/${Stage}.ll "${${Stage}}")
+  if(HANGS)
+    execute_process(COMMAND ${LLI} -load=${RUNTIME} ${WORK_DIR}/${Stage}.ll
+                    TIMEOUT 3
+                    OUTPUT_QUIET
+                    RESULT_VARIABLE Result)
+    if(NOT Result MATCHES "timeout")
+      message(FATAL_ERROR "${Stage} module ended (${Result}) but should not")
+    endif()
+    continue()
+  endif()
+  execute_process(COMMAND ${LLI} -load=${RUNTIME} ${WORK_DIR}/${Stage}.ll
+                  OUTPUT_VARIABLE Output
+                  ERROR_VARIABLE Error
+                  RESULT_VARIABLE Result)
+  if(NOT Result EQUAL 0)
+    message(FATAL_ERROR "${Stage} module failed:\n${Error}")
+  endif()
+  if(NOT Output STREQUAL Expected)
+    message(FATAL_ERROR "${Stage} module printed:\n${Output}expected:\n${Expected}")
+  endif()
+endforeach()
@@ -0,0 +1,283 @@
+// Counts heap allocations around the traversals of a parsed program by
+// Sema, the Optimizer and CodeGen, and fails if a read-only walk
+// allocates: child lists are views of arrays in the ASTContext arena, so
+// reading them must never copy.
+//
+// Some passes allocate by design and are exempt:
+// - ToIRVisitor::run: IRBuilder allocates every instruction it creates.
+// - DetectDeadVars: it builds the control-flow graph, with a definition
+//   list and a liveness bitset per block.
+// - The rewriting passes of the Optimizer keep maps of the expressions
+//   and values they have seen.
+// - Sema sizes its scope bitset once per run, which allocates for programs
+//   with more than 384 variables; the test program has fewer.
+// For the Optimizer and CodeGen the test checks their read-only parts
+// instead: CollectReferences, and the cost model that CodeGen orders and/or
+// operands by. Those live in Optimizer.cpp and CodeGen.cpp, so this file
+// includes both to reach them.
+
+#include "../src/CodeGen.cpp"
+#include "../src/Optimizer.cpp"
+#include "Parser.h"
+#include "Sema.h"
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+
+static unsigned long NumAllocations = 0;
+
+// Count both allocation paths, operator new and the C allocator that
+// SmallVector and the other LLVM containers grow with.
+void *operator new(size_t Size)
+{
+    ++NumAllocations;
+    if (void *Ptr = std::malloc(Size ? Size : 1))
+        return Ptr;
+    std::abort();
+}
+
+void operator delete(void *Ptr) noexcept { std::free(Ptr); }
+void operator delete(void *Ptr, size_t) noexcept { std::free(Ptr); }
+
+#ifdef __GLIBC__
+extern "C" void *__libc_malloc(size_t);
+extern "C" void *__libc_calloc(size_t, size_t);
+extern "C" void *__libc_realloc(void *, size_t);
+
+extern "C" void *malloc(size_t Size)
+{
+    ++NumAllocations;
+    return __libc_malloc(Size);
+}
+
+extern "C" void *calloc(size_t Count, size_t Size)
+{
+    ++NumAllocations;
+    return __libc_calloc(Count, Size);
+}
+
+extern "C" void *realloc(void *Ptr, size_t Size)
+{
+    ++NumAllocations;
+    return __libc_realloc(Ptr, Size);
+}
+#endif
+
+namespace
+{
+// Visits every node reachable through the child list accessors, both
+// the array views and the begin/end iterator pairs.
+class WalkChildLists : public StaticASTVisitor<WalkChildLists>
+{
+public:
+    unsigned NumNodes = 0;
+
+    using StaticASTVisitor<WalkChildLists>::visit;
+
+    void visit(ARK &Node)
+    {
+        ++NumNodes;
+        for (Statement *S : Node.getStatements())
+            dispatch(S);
+        for (auto I = Node.begin(), E = Node.end(); I != E; ++I)
+            ++NumNodes;
+    }
+
+    void visit(Declare &Node)
+    {
+        ++NumNodes;
+        for (Expr *E : Node.getExprs())
+            dispatch(E);
+        NumNodes += Node.getVars().size() + Node.getSymbols().size();
+        for (auto I = Node.VarsBegin(), E = Node.VarsEnd(); I != E; ++I)
+            ++NumNodes;
+        for (auto I = Node.ExprsBegin(), E = Node.ExprsEnd(); I != E; ++I)
+            ++NumNodes;
+    }
+
+    void visit(Assign &Node)
+    {
+        ++NumNodes;
+        dispatch(Node.getRight());
+    }
+
+    template <typename BranchT>
+    void visitAssignments(BranchT &Node)
+    {
+        for (Assign *A : Node.getAssignments())
+            dispatch(A);
+        for (auto I = Node.AssignmentsBegin(), E = Node.AssignmentsEnd(); I != E; ++I)
+            ++NumNodes;
+    }
+
+    void visit(If &Node)
+    {
+        ++NumNodes;
+        dispatch(Node.getConds());
+        visitAssignments(Node);
+        for (Elif *E : Node.getElifs())
+        {
+            dispatch(E->getConds());
+            visitAssignments(*E);
+        }
+        for (auto I = Node.ElifsBegin(), E = Node.ElifsEnd(); I != E; ++I)
+            ++NumNodes;
+        if (Else *ElseBranch = Node.getElse())
+            visitAssignments(*ElseBranch);
+    }
+
+    void visit(Loop &Node)
+    {
+        ++NumNodes;
+        dispatch(Node.getConds());
+        visitAssignments(Node);
+    }
+
+    void visit(Expr &Node)
+    {
+        ++NumNodes;
+        dispatch(Node.getLeft());
+        if (Node.getRight())
+            dispatch(Node.getRight());
+    }
+
+    void visit(Final &) { ++NumNodes; }
+
+    void visit(Conditions &Node)
+    {
+        ++NumNodes;
+        dispatch(Node.getLeft());
+        if (Node.getRight())
+            dispatch(Node.getRight());
+    }
+
+    void visit(Condition &Node)
+    {
+        ++NumNodes;
+        dispatch(Node.getLeft());
+        dispatch(Node.getRight());
+    }
+};
+
+// Runs every cost query CodeGen makes for the conditions of Tree.
+class QueryCosts : public StaticASTVisitor<QueryCosts>
+{
+    void query(Conditions *Conds)
+    {
+        bool MayTrap = false;
+        Total += ns::getCost(Conds, MayTrap);
+        for (Conditions *C = Conds; C; C = C->getRight())
+        {
+            if (llvm::isa<Condition>(C))
+            {
+                Total += ns::getSelectivityRank(C, Conds->getSign());
+                break;
+            }
+            Total += ns::getSelectivityRank(C->getLeft(), C->getSign());
+        }
+    }
+
+public:
+    unsigned Total = 0;
+
+    using StaticASTVisitor<QueryCosts>::visit;
+
+    void visit(ARK &Node)
+    {
+        for (Statement *S : Node.getStatements())
+            dispatch(S);
+    }
+
+    void visit(If &Node)
+    {
+        query(Node.getConds());
+        for (Elif *E : Node.getElifs())
+            query(E->getConds());
+    }
+
+    void visit(Loop &Node) { query(Node.getConds()); }
+};
+
+template <typename Fn>
+bool checkNoAllocations(const char *Name, Fn Walk)
+{
+    unsigned long Before = NumAllocations;
+    Walk();
+    unsigned long Allocated = NumAllocations - Before;
+    if (Allocated != 0)
+    {
+        std::fprintf(stderr, "%s allocated %lu times\n", Name, Allocated);
+        return false;
+    }
+    std::printf("%s did not allocate\n", Name);
+    return true;
+}
+} // namespace
+
+int main()
+{
+    static const char Declarations[] =
+        "int a, b, c = 1, 2;\n"
+        "int result = a + b * c;\n";
+    static const char Body[] =
+        "a += 3;\n"
+        "if a > b and b < c and c != 4 and a / 2 == 1: begin\n"
+        "  result = a;\n"
+        "  b -= 1;\n"
+        "end\n"
+        "elif a == 4: begin\n"
+        "  result = b ^ 3;\n"
+        "end\n"
+        "elif c != 0 or a <= 2 or (b + 1) * 3 >= c % 5: begin\n"
+        "  result = c;\n"
+        "end\n"
+        "else: begin\n"
+        "  result = 0;\n"
+        "end\n"
+        "loopc a < 10: begin\n"
+        "  a += 1;\n"
+        "  result *= 2;\n"
+        "end\n";
+    std::string Source = Declarations;
+    for (unsigned I = 0; I < 50; ++I)
+        Source += Body;
+
+    ASTContext Context;
+    Lexer Lex(Source);
+    Parser Parser(Lex, Context);
+    AST *Tree = Parser.parse();
+    if (!Tree || Parser.hasError())
+    {
+        std::fprintf(stderr, "the test program did not parse\n");
+        return 1;
+    }
+
+    bool Passed = true;
+
+    WalkChildLists Walk;
+    Passed &= checkNoAllocations("walking the child lists", [&] { Walk.dispatch(Tree); });
+
+    bool SemaFailed = false;
+    Passed &= checkNoAllocations("Sema::semantic", [&] {
+        Sema Semantic;
+        SemaFailed = Semantic.semantic(Tree, Context);
+    });
+    if (SemaFailed)
+    {
+        std::fprintf(stderr, "the test program has semantic errors\n");
+        return 1;
+    }
+
+    llvm::BitVector Referenced(Context.getNumSymbols());
+    OptimizationMethods::CollectReferences Collect(Referenced);
+    Passed &= checkNoAllocations("CollectReferences", [&] {
+        for (Statement *S : llvm::cast<ARK>(Tree)->getStatements())
+            Collect.dispatch(S);
+    });
+
+    QueryCosts Costs;
+    Passed &= checkNoAllocations("CodeGen's cost model", [&] { Costs.dispatch(Tree); });
+
+    return Passed ? 0 : 1;
+}